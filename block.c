@@ -0,0 +1,187 @@
+#include "block.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* ----------------- code 長度 ----------------- */
+
+void limit_code_lengths(unsigned char *lengths, const unsigned long long *hist, int max_len) {
+    int longest = 0;
+    for (int s = 0; s < BLOCK_NUM_SYMBOLS; s++) {
+        if (lengths[s] > longest) longest = lengths[s];
+    }
+    if (longest <= max_len) return;
+
+    /* 以 2^-max_len 為單位計算 Kraft 和，cap 代表剛好等於 1 */
+    unsigned long long cap = 1ULL << max_len;
+    unsigned long long kraft = 0;
+    for (int s = 0; s < BLOCK_NUM_SYMBOLS; s++) {
+        if (lengths[s] == 0) continue;
+        if (lengths[s] > max_len) lengths[s] = (unsigned char)max_len;
+        kraft += 1ULL << (max_len - lengths[s]);
+    }
+
+    /* 超過 1：把目前最長（但還沒到 max_len）的 code 裡最少見的加長一個 bit，
+       每次只扣掉最小的量 */
+    while (kraft > cap) {
+        int pick = -1;
+        for (int s = 0; s < BLOCK_NUM_SYMBOLS; s++) {
+            if (lengths[s] == 0 || lengths[s] >= max_len) continue;
+            if (pick < 0 || lengths[s] > lengths[pick] ||
+               (lengths[s] == lengths[pick] && hist[s] < hist[pick])) {
+                pick = s;
+            }
+        }
+        if (pick < 0) break;   // 理論上不會發生：symbol 數不超過 2^max_len
+        kraft -= 1ULL << (max_len - lengths[pick] - 1);
+        lengths[pick]++;
+    }
+
+    /* 還有剩：從最常見的 symbol 開始，能縮短就縮短 */
+    for (;;) {
+        int pick = -1;
+        for (int s = 0; s < BLOCK_NUM_SYMBOLS; s++) {
+            if (lengths[s] <= 1) continue;
+            if (kraft + (1ULL << (max_len - lengths[s])) > cap) continue;
+            if (pick < 0 || hist[s] > hist[pick]) pick = s;
+        }
+        if (pick < 0) break;
+        kraft += 1ULL << (max_len - lengths[pick]);
+        lengths[pick]--;
+    }
+}
+
+void canonical_codes(const unsigned char *lengths, unsigned int *codes) {
+    unsigned int count[BLOCK_MAX_CODE_LEN + 2] = {0};
+    unsigned int next[BLOCK_MAX_CODE_LEN + 2] = {0};
+
+    for (int s = 0; s < BLOCK_NUM_SYMBOLS; s++) count[lengths[s]]++;
+    count[0] = 0;
+
+    unsigned int code = 0;
+    for (int len = 1; len <= BLOCK_MAX_CODE_LEN; len++) {
+        code = (code + count[len - 1]) << 1;
+        next[len] = code;
+    }
+
+    for (int s = 0; s < BLOCK_NUM_SYMBOLS; s++) {
+        codes[s] = lengths[s] ? next[lengths[s]]++ : 0;
+    }
+}
+
+/* ----------------- 編碼 / 解碼 ----------------- */
+
+size_t block_max_encoded(size_t n) {
+    return n / 8 * BLOCK_MAX_CODE_LEN + BLOCK_MAX_CODE_LEN + 8;
+}
+
+size_t block_encode(const unsigned char *in, size_t n, const unsigned char *lengths, unsigned char *out) {
+    unsigned int codes[BLOCK_NUM_SYMBOLS];
+    canonical_codes(lengths, codes);
+
+    unsigned long long acc = 0;   /* 還沒寫出去的 bit，靠右對齊 */
+    int nbits = 0;
+    size_t k = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        int len = lengths[in[i]];
+        acc = (acc << len) | codes[in[i]];
+        nbits += len;
+        if (nbits >= 32) {
+            nbits -= 32;
+            unsigned int word = (unsigned int)(acc >> nbits);
+            out[k++] = (unsigned char)(word >> 24);
+            out[k++] = (unsigned char)(word >> 16);
+            out[k++] = (unsigned char)(word >> 8);
+            out[k++] = (unsigned char)word;
+            acc &= (1ULL << nbits) - 1;
+        }
+    }
+    while (nbits >= 8) {
+        nbits -= 8;
+        out[k++] = (unsigned char)(acc >> nbits);
+    }
+    if (nbits > 0) {
+        out[k++] = (unsigned char)(acc << (8 - nbits));
+    }
+    return k;
+}
+
+int block_decode(const unsigned char *in, size_t in_len, const unsigned char *lengths,
+                 unsigned char *out, size_t raw_len) {
+    unsigned int codes[BLOCK_NUM_SYMBOLS];
+    unsigned short table[1 << BLOCK_MAX_CODE_LEN];   /* (symbol << 4) | 長度，0 表示不合法 */
+    int max_len = 0;
+
+    for (int s = 0; s < BLOCK_NUM_SYMBOLS; s++) {
+        if (lengths[s] > BLOCK_MAX_CODE_LEN) return -1;
+        if (lengths[s] > max_len) max_len = lengths[s];
+    }
+    if (raw_len == 0) return 0;
+    if (max_len == 0) return -1;
+
+    canonical_codes(lengths, codes);
+    memset(table, 0, sizeof(unsigned short) << max_len);
+    for (int s = 0; s < BLOCK_NUM_SYMBOLS; s++) {
+        int len = lengths[s];
+        if (len == 0) continue;
+        unsigned int first = codes[s] << (max_len - len);
+        unsigned int last = (codes[s] + 1) << (max_len - len);
+        if (last > (1u << max_len)) return -1;   // code 長度不符合 Kraft 不等式
+        for (unsigned int j = first; j < last; j++) {
+            table[j] = (unsigned short)((s << 4) | len);
+        }
+    }
+
+    unsigned long long buf = 0;
+    int nbits = 0;
+    size_t in_pos = 0;
+
+    for (size_t i = 0; i < raw_len; i++) {
+        while (nbits <= 56 && in_pos < in_len) {
+            buf |= (unsigned long long)in[in_pos++] << (56 - nbits);
+            nbits += 8;
+        }
+        unsigned short e = table[buf >> (64 - max_len)];
+        int len = e & 0xF;
+        if (len == 0 || len > nbits) return -1;
+        out[i] = (unsigned char)(e >> 4);
+        buf <<= len;
+        nbits -= len;
+    }
+    return 0;
+}
+
+/* ----------------- header ----------------- */
+
+static void put_u32(unsigned char *p, unsigned int v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+    p[3] = (unsigned char)(v >> 24);
+}
+
+static unsigned int get_u32(const unsigned char *p) {
+    return (unsigned int)p[0] | ((unsigned int)p[1] << 8) |
+           ((unsigned int)p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+void block_write_header(unsigned char *hdr, unsigned int raw_len, unsigned int data_len,
+                        const unsigned char *lengths) {
+    put_u32(hdr, raw_len);
+    put_u32(hdr + 4, data_len);
+    for (int i = 0; i < BLOCK_LENGTHS_SIZE; i++) {
+        hdr[8 + i] = (unsigned char)((lengths[2 * i] << 4) | (lengths[2 * i + 1] & 0xF));
+    }
+}
+
+void block_read_header(const unsigned char *hdr, unsigned int *raw_len, unsigned int *data_len,
+                       unsigned char *lengths) {
+    *raw_len = get_u32(hdr);
+    *data_len = get_u32(hdr + 4);
+    for (int i = 0; i < BLOCK_LENGTHS_SIZE; i++) {
+        lengths[2 * i] = (unsigned char)(hdr[8 + i] >> 4);
+        lengths[2 * i + 1] = (unsigned char)(hdr[8 + i] & 0xF);
+    }
+}
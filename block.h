@@ -0,0 +1,46 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include <stddef.h>
+
+/* 分塊（block）格式的 encoded.bin：
+   - 檔頭：BLOCK_MAGIC 4 bytes + 版本 1 byte
+   - 每個 block：raw_len（u32 LE）、data_len（u32 LE）、256 個 byte symbol 的 code 長度
+     （每個 4 bit，共 BLOCK_LENGTHS_SIZE bytes），接著 data_len bytes 的 bitstream
+   - raw_len 為 0 的 block 表示結束
+   每個 block 用自己的 canonical Huffman code，所以只需要讀一遍輸入，記憶體用量只跟 block 大小有關。 */
+
+#define BLOCK_MAGIC        "HUFB"
+#define BLOCK_VERSION      1
+#define BLOCK_FILE_HEADER_SIZE 5
+#define BLOCK_NUM_SYMBOLS  256
+#define BLOCK_MAX_CODE_LEN 15
+#define BLOCK_LENGTHS_SIZE (BLOCK_NUM_SYMBOLS / 2)
+#define BLOCK_HEADER_SIZE  (8 + BLOCK_LENGTHS_SIZE)
+
+/* 單一 block 的上限，也用來檢查讀進來的 header */
+#define BLOCK_MAX_SIZE     (256u << 20)
+
+/* 把 code 長度限制在 max_len 以內並維持 Kraft 不等式，
+   hist 用來決定要加長哪些比較少見的 symbol */
+void limit_code_lengths(unsigned char *lengths, const unsigned long long *hist, int max_len);
+
+/* 依 code 長度產生 canonical code（codes[s] 的低 lengths[s] 個 bit） */
+void canonical_codes(const unsigned char *lengths, unsigned int *codes);
+
+/* n 個 byte 編碼後最多佔多少 bytes */
+size_t block_max_encoded(size_t n);
+
+/* 編碼一個 block，回傳寫進 out 的 bytes 數 */
+size_t block_encode(const unsigned char *in, size_t n, const unsigned char *lengths, unsigned char *out);
+
+/* 解碼一個 block，成功回傳 0，bitstream 或 code 長度不合法回傳 -1 */
+int block_decode(const unsigned char *in, size_t in_len, const unsigned char *lengths,
+                 unsigned char *out, size_t raw_len);
+
+void block_write_header(unsigned char *hdr, unsigned int raw_len, unsigned int data_len,
+                        const unsigned char *lengths);
+void block_read_header(const unsigned char *hdr, unsigned int *raw_len, unsigned int *data_len,
+                       unsigned char *lengths);
+
+#endif /* BLOCK_H */
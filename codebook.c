@@ -0,0 +1,270 @@
+#include "codebook.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* ----------------- 解析 symbol 字串 ----------------- */
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+int parse_symbol(const char *s, CodebookEntry *e) {
+    size_t n = strlen(s);
+    e->len = 0;
+
+    if (strcmp(s, "\\n") == 0) { e->bytes[0] = '\n'; e->len = 1; return '\n'; }
+    if (strcmp(s, "\\r") == 0) { e->bytes[0] = '\r'; e->len = 1; return '\r'; }
+    if (strcmp(s, "EOF") == 0)  return EOF_SYMBOL;
+
+    if (strncmp(s, "0x", 2) == 0 && n > 2 && n % 2 == 0 && (n - 2) / 2 <= MAX_TOKEN_LEN) {
+        // 0xXX 是單一 byte，更長的是 hex 寫法的 token
+        for (size_t i = 2; i < n; i += 2) {
+            int hi = hex_value(s[i]), lo = hex_value(s[i + 1]);
+            if (hi < 0 || lo < 0) return -1;
+            e->bytes[e->len++] = (unsigned char)(hi * 16 + lo);
+        }
+        return (e->len == 1) ? e->bytes[0] : FIRST_TOKEN_SYMBOL;
+    }
+
+    if (n == 1) {
+        e->bytes[0] = (unsigned char)s[0];
+        e->len = 1;
+        return (unsigned char)s[0];
+    }
+
+    // 英文字母與空白組成的 token 直接寫在 codebook 裡
+    if (n <= MAX_TOKEN_LEN) {
+        memcpy(e->bytes, s, n);
+        e->len = (int)n;
+        return FIRST_TOKEN_SYMBOL;
+    }
+
+    // 無法解析的就略過
+    return -1;
+}
+
+/* ----------------- 讀 codebook.csv ----------------- */
+
+int codebook_load(const char *filename, Codebook *cb) {
+    FILE *fcb = fopen(filename, "r");
+    if (!fcb) return -1;
+
+    cb->entries = (CodebookEntry *)malloc(sizeof(CodebookEntry) * MAX_ALPHABET);
+    if (!cb->entries) {
+        fprintf(stderr, "malloc failed\n");
+        exit(1);
+    }
+    cb->num_entries = 0;
+    cb->block_format = 0;
+    cb->table_bits = 0;
+
+    char line[512];
+    while (fgets(line, sizeof(line), fcb) && cb->num_entries < MAX_ALPHABET) {
+        if (line[0] == '#') {
+            if (strstr(line, "format=blocks")) cb->block_format = 1;
+            const char *tb = strstr(line, "table_bits=");
+            if (tb) {
+                cb->table_bits = atoi(tb + strlen("table_bits="));
+                if (cb->table_bits < 0) cb->table_bits = 0;
+                if (cb->table_bits > CODEBOOK_TABLE_BITS_MAX) cb->table_bits = CODEBOOK_TABLE_BITS_MAX;
+            }
+            continue;
+        }
+
+        char symbol_str[128], code[MAX_CODE_LEN];
+        unsigned long long count;
+        double prob, self_info;
+
+        if (sscanf(line, "\"%127[^\"]\",%llu,%lf,\"%127[^\"]\",%lf",
+                   symbol_str, &count, &prob, code, &self_info) == 5) {
+            CodebookEntry *e = &cb->entries[cb->num_entries];
+            int s = parse_symbol(symbol_str, e);
+            if (s == -1) continue;
+            e->sym = s;
+            strcpy(e->code, code);
+            cb->num_entries++;
+        }
+    }
+    fclose(fcb);
+    return 0;
+}
+
+void codebook_free(Codebook *cb) {
+    free(cb->entries);
+    cb->entries = NULL;
+    cb->num_entries = 0;
+}
+
+/* ----------------- 多層解碼查表 ----------------- */
+
+typedef struct {
+    unsigned int slot;
+    int idx;
+} SlotRef;
+
+typedef struct {
+    const Codebook *cb;
+    const int *code_len;
+    DecodeTable *t;
+} TableBuilder;
+
+/* code 字串從第 from 個 bit 開始取 k 個 bit */
+static unsigned int code_bits(const char *code, int from, int k) {
+    unsigned int v = 0;
+    for (int i = 0; i < k; i++) {
+        v = (v << 1) | (code[from + i] == '1' ? 1u : 0u);
+    }
+    return v;
+}
+
+static size_t table_alloc(DecodeTable *t, int width) {
+    size_t n = (size_t)1 << width;
+    if (t->size + n > t->cap) {
+        while (t->size + n > t->cap) t->cap = t->cap ? t->cap * 2 : 4096;
+        t->data = (unsigned int *)realloc(t->data, sizeof(unsigned int) * t->cap);
+        if (!t->data) {
+            fprintf(stderr, "malloc failed\n");
+            exit(1);
+        }
+    }
+    size_t offset = t->size;
+    for (size_t i = 0; i < n; i++) {
+        t->data[offset + i] = (DTABLE_INVALID_SYMBOL << 8) | (unsigned int)width;
+    }
+    t->size += n;
+    return offset;
+}
+
+static int is_free(unsigned int e) {
+    return !(e & DTABLE_LINK_FLAG) && ((e >> 8) & DTABLE_INDEX_MASK) == DTABLE_INVALID_SYMBOL;
+}
+
+static int cmp_slot(const void *a, const void *b) {
+    const SlotRef *x = (const SlotRef *)a;
+    const SlotRef *y = (const SlotRef *)b;
+    if (x->slot != y->slot) return (x->slot < y->slot) ? -1 : 1;
+    return x->idx - y->idx;
+}
+
+/* 把 idx[] 裡的 code（前 depth 個 bit 都相同）填進 offset 開始、寬 width 的表，
+   回傳 0 表示成功，-2 表示 codebook 不是 prefix code */
+static int build_level(TableBuilder *b, const int *idx, int n, int depth, int width, size_t offset) {
+    DecodeTable *t = b->t;
+    SlotRef *longer = (SlotRef *)malloc(sizeof(SlotRef) * (n > 0 ? n : 1));
+    if (!longer) {
+        fprintf(stderr, "malloc failed\n");
+        exit(1);
+    }
+    int num_longer = 0;
+
+    for (int i = 0; i < n; i++) {
+        const char *code = b->cb->entries[idx[i]].code;
+        int rest = b->code_len[idx[i]] - depth;
+
+        if (rest <= width) {
+            unsigned int base = code_bits(code, depth, rest) << (width - rest);
+            unsigned int fill = 1u << (width - rest);
+            for (unsigned int j = 0; j < fill; j++) {
+                if (!is_free(t->data[offset + base + j])) {
+                    free(longer);
+                    return -2;
+                }
+                t->data[offset + base + j] = ((unsigned int)idx[i] << 8) | (unsigned int)rest;
+            }
+        } else {
+            longer[num_longer].slot = code_bits(code, depth, width);
+            longer[num_longer].idx = idx[i];
+            num_longer++;
+        }
+    }
+
+    qsort(longer, (size_t)num_longer, sizeof(SlotRef), cmp_slot);
+
+    int *group = (int *)malloc(sizeof(int) * (num_longer > 0 ? num_longer : 1));
+    if (!group) {
+        fprintf(stderr, "malloc failed\n");
+        exit(1);
+    }
+
+    int status = 0;
+    for (int i = 0; i < num_longer && status == 0; ) {
+        unsigned int slot = longer[i].slot;
+        int m = 0, max_len = 0;
+        while (i < num_longer && longer[i].slot == slot) {
+            group[m++] = longer[i].idx;
+            if (b->code_len[longer[i].idx] > max_len) max_len = b->code_len[longer[i].idx];
+            i++;
+        }
+
+        if (!is_free(t->data[offset + slot])) {
+            status = -2;
+            break;
+        }
+
+        int sub_width = max_len - (depth + width);
+        if (sub_width > DTABLE_SUB_BITS_MAX) sub_width = DTABLE_SUB_BITS_MAX;
+        size_t sub = table_alloc(t, sub_width);
+        t->data[offset + slot] = DTABLE_LINK_FLAG | ((unsigned int)sub << 8) | (unsigned int)sub_width;
+        status = build_level(b, group, m, depth + width, sub_width, sub);
+    }
+
+    free(group);
+    free(longer);
+    return status;
+}
+
+int codebook_build_table(const Codebook *cb, int root_bits_max, DecodeTable *t) {
+    t->data = NULL;
+    t->size = 0;
+    t->cap = 0;
+    t->root_bits = 0;
+    t->max_code_len = 0;
+
+    int n = cb->num_entries;
+    int *code_len = (int *)malloc(sizeof(int) * (n > 0 ? n : 1));
+    int *all = (int *)malloc(sizeof(int) * (n > 0 ? n : 1));
+    if (!code_len || !all) {
+        fprintf(stderr, "malloc failed\n");
+        exit(1);
+    }
+
+    int status = 0;
+    for (int i = 0; i < n && status == 0; i++) {
+        const char *code = cb->entries[i].code;
+        for (int j = 0; code[j]; j++) {
+            if (code[j] != '0' && code[j] != '1') {
+                status = -1;
+                break;
+            }
+        }
+        code_len[i] = (int)strlen(code);
+        if (code_len[i] > t->max_code_len) t->max_code_len = code_len[i];
+        all[i] = i;
+    }
+
+    if (status == 0) {
+        t->root_bits = (t->max_code_len < root_bits_max) ? t->max_code_len : root_bits_max;
+        if (t->root_bits < 1) t->root_bits = 1;
+
+        TableBuilder b = { cb, code_len, t };
+        size_t root = table_alloc(t, t->root_bits);
+        status = build_level(&b, all, n, 0, t->root_bits, root);
+    }
+
+    free(code_len);
+    free(all);
+    if (status != 0) decode_table_free(t);
+    return status;
+}
+
+void decode_table_free(DecodeTable *t) {
+    free(t->data);
+    t->data = NULL;
+    t->size = 0;
+    t->cap = 0;
+}
@@ -0,0 +1,58 @@
+#ifndef CODEBOOK_H
+#define CODEBOOK_H
+
+#include <stddef.h>
+#include "tokenizer.h"
+
+#define MAX_CODE_LEN 128
+
+/* codebook.csv 的一列 */
+typedef struct {
+    int sym;               // byte 值、EOF_SYMBOL 或 FIRST_TOKEN_SYMBOL（token）
+    char code[MAX_CODE_LEN];
+    unsigned char bytes[MAX_TOKEN_LEN];   // 解碼後要輸出的內容
+    int len;
+} CodebookEntry;
+
+typedef struct {
+    CodebookEntry *entries;
+    int num_entries;
+    int block_format;      // "# format=blocks"：每個 block 的 code 在 encoded.bin 裡
+    int table_bits;        // "# table_bits=N"：encoder 建議的第一層查表寬度，0 表示沒指定
+} Codebook;
+
+/* 解析 codebook 裡的 symbol 字串，回傳 symbol 種類（無法解析回傳 -1），
+   並把解碼後要輸出的 bytes 填進 e */
+int parse_symbol(const char *s, CodebookEntry *e);
+
+/* 讀 codebook.csv，成功回傳 0，檔案打不開回傳 -1 */
+int codebook_load(const char *filename, Codebook *cb);
+void codebook_free(Codebook *cb);
+
+/* ----------------- 多層解碼查表 -----------------
+   第一層看 root_bits 個 bit（預設最多 DTABLE_ROOT_BITS_MAX，codebook 有指定 table_bits 時照它），
+   比較長的 code 接到每層最多 DTABLE_SUB_BITS_MAX 個 bit 的子表。
+   entry 的編碼（unsigned int）：
+   - 葉節點：(entry index << 8) | 這一層用掉的 bit 數
+   - 子表  ：DTABLE_LINK_FLAG | (子表 offset << 8) | 子表寬度
+   - 不合法：entry index 為 DTABLE_INVALID_SYMBOL */
+#define DTABLE_ROOT_BITS_MAX  11
+#define CODEBOOK_TABLE_BITS_MAX 16   /* codebook 指定的 table_bits 上限 */
+#define DTABLE_SUB_BITS_MAX   8
+#define DTABLE_LINK_FLAG      0x80000000u
+#define DTABLE_INDEX_MASK     0x7FFFFFu
+#define DTABLE_INVALID_SYMBOL 0x7FFFFFu
+
+typedef struct {
+    unsigned int *data;
+    size_t size;
+    size_t cap;
+    int root_bits;
+    int max_code_len;
+} DecodeTable;
+
+/* 由 codebook 建查表，成功回傳 0；code 有非 0/1 字元回傳 -1，不是 prefix code 回傳 -2 */
+int codebook_build_table(const Codebook *cb, int root_bits_max, DecodeTable *t);
+void decode_table_free(DecodeTable *t);
+
+#endif /* CODEBOOK_H */
@@ -0,0 +1,196 @@
+#include "coder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void bytebuf_reserve(ByteBuf *b, size_t extra) {
+    if (b->len + extra <= b->cap) return;
+
+    size_t cap = b->cap ? b->cap : 4096;
+    while (cap < b->len + extra) cap *= 2;
+    b->data = (unsigned char *)realloc(b->data, cap);
+    if (!b->data) {
+        fprintf(stderr, "malloc failed\n");
+        exit(1);
+    }
+    b->cap = cap;
+}
+
+void bytebuf_free(ByteBuf *b) {
+    free(b->data);
+    b->data = NULL;
+    b->len = 0;
+    b->cap = 0;
+}
+
+/* ----------------- 載入 ----------------- */
+
+int coder_load(Coder *c, const char *filename) {
+    if (codebook_load(filename, &c->cb) != 0) return -1;
+
+    c->code_bits = (unsigned long long *)calloc(MAX_ALPHABET, sizeof(unsigned long long));
+    c->code_len = (unsigned char *)calloc(MAX_ALPHABET, sizeof(unsigned char));
+    if (!c->code_bits || !c->code_len) {
+        fprintf(stderr, "malloc failed\n");
+        exit(1);
+    }
+    vocab_init(&c->vocab, MAX_TOKENS);
+
+    /* 分塊格式的 codebook 沒有固定的 code，不能常駐使用 */
+    int root_bits = (c->cb.table_bits > 0) ? c->cb.table_bits : DTABLE_ROOT_BITS_MAX;
+    memset(&c->dtable, 0, sizeof(c->dtable));
+    int status = c->cb.block_format ? -2 : codebook_build_table(&c->cb, root_bits, &c->dtable);
+    if (status == 0 && c->dtable.max_code_len > CODER_MAX_CODE_LEN) {
+        decode_table_free(&c->dtable);
+        status = -2;
+    }
+
+    /* token 依 codebook 裡的順序編號，只在這個 Coder 內部使用 */
+    for (int i = 0; i < c->cb.num_entries && status == 0; i++) {
+        const CodebookEntry *e = &c->cb.entries[i];
+        int sym = e->sym;
+        if (sym == FIRST_TOKEN_SYMBOL) {
+            sym = vocab_add(&c->vocab, e->bytes, e->len);
+            if (sym < 0) {
+                status = -2;
+                break;
+            }
+        }
+
+        unsigned long long bits = 0;
+        int len = (int)strlen(e->code);
+        for (int j = 0; j < len; j++) {
+            bits = (bits << 1) | (e->code[j] == '1' ? 1ULL : 0ULL);
+        }
+        c->code_bits[sym] = bits;
+        c->code_len[sym] = (unsigned char)len;
+    }
+
+    if (status == 0 && c->code_len[EOF_SYMBOL] == 0) status = -2;
+    if (status != 0) {
+        decode_table_free(&c->dtable);
+        vocab_free(&c->vocab);
+        free(c->code_bits);
+        free(c->code_len);
+        codebook_free(&c->cb);
+        return -2;
+    }
+    return 0;
+}
+
+void coder_free(Coder *c) {
+    decode_table_free(&c->dtable);
+    vocab_free(&c->vocab);
+    free(c->code_bits);
+    free(c->code_len);
+    c->code_bits = NULL;
+    c->code_len = NULL;
+    codebook_free(&c->cb);
+}
+
+/* ----------------- 編碼 ----------------- */
+
+typedef struct {
+    const Coder *c;
+    ByteBuf *out;
+    unsigned long long acc;   /* 還沒湊滿 8 bit 的部分，靠右對齊 */
+    int nbits;
+    int error;
+} BitSink;
+
+static void sink_symbol(int sym, void *ctx) {
+    BitSink *s = (BitSink *)ctx;
+    int len = s->c->code_len[sym];
+    if (len == 0) {
+        s->error = 1;
+        return;
+    }
+
+    s->acc = (s->acc << len) | s->c->code_bits[sym];
+    s->nbits += len;
+    while (s->nbits >= 8) {
+        s->nbits -= 8;
+        s->out->data[s->out->len++] = (unsigned char)(s->acc >> s->nbits);
+    }
+    s->acc &= (1ULL << s->nbits) - 1;
+}
+
+int coder_encode(const Coder *c, const unsigned char *in, size_t in_len, ByteBuf *out) {
+    /* 每個 byte 最多產生一個 symbol，先一次預留好最壞情況的空間 */
+    bytebuf_reserve(out, (in_len + 1) * (size_t)c->dtable.max_code_len / 8 + 2);
+
+    BitSink s = { c, out, 0, 0, 0 };
+
+    if (c->vocab.num_tokens > 0) {
+        TokenEncoder te;
+        token_encoder_init(&te, &c->vocab, sink_symbol, &s);
+        size_t pos = 0;
+        while (pos < in_len) {
+            int n = next_piece(in + pos, in_len - pos, 1);
+            token_encoder_piece(&te, in + pos, n);
+            pos += (size_t)n;
+        }
+        token_encoder_flush(&te);
+    } else {
+        for (size_t i = 0; i < in_len; i++) {
+            sink_symbol(in[i], &s);
+        }
+    }
+    if (s.error) return -1;
+
+    sink_symbol(EOF_SYMBOL, &s);
+    if (s.nbits > 0) {
+        out->data[out->len++] = (unsigned char)(s.acc << (8 - s.nbits));
+    }
+    return 0;
+}
+
+/* ----------------- 解碼 ----------------- */
+
+int coder_decode(const Coder *c, const unsigned char *in, size_t in_len, size_t max_out, ByteBuf *out) {
+    const size_t out_end = out->len + max_out;   // 解出的資料最多只能寫到這裡
+    const unsigned int *table = c->dtable.data;
+    const int root_bits = c->dtable.root_bits;
+    unsigned long long buf = 0;
+    int nbits = 0;
+    size_t in_pos = 0;
+
+    for (;;) {
+        while (nbits <= 56 && in_pos < in_len) {
+            buf |= (unsigned long long)in[in_pos++] << (56 - nbits);
+            nbits += 8;
+        }
+        if (nbits == 0) return -1;   // 沒有碰到 EOF symbol 就結束，資料被截斷
+
+        int w = root_bits;
+        unsigned int e = table[buf >> (64 - root_bits)];
+        while (e & DTABLE_LINK_FLAG) {
+            if (w > nbits) return -1;   // bitstream 在 code 中間結束
+            buf <<= w;
+            nbits -= w;
+            while (nbits <= 56 && in_pos < in_len) {
+                buf |= (unsigned long long)in[in_pos++] << (56 - nbits);
+                nbits += 8;
+            }
+            w = (int)(e & 0xFFu);
+            e = table[((e >> 8) & DTABLE_INDEX_MASK) + (unsigned int)(buf >> (64 - w))];
+        }
+
+        int len = (int)(e & 0xFFu);
+        unsigned int idx = (e >> 8) & DTABLE_INDEX_MASK;
+        if (len > nbits) return -1;
+        if (idx == DTABLE_INVALID_SYMBOL) return -1;
+        buf <<= len;
+        nbits -= len;
+
+        const CodebookEntry *entry = &c->cb.entries[idx];
+        if (entry->sym == EOF_SYMBOL) return 0;
+
+        // 先檢查上限再配置，短的 code 對應長 token 時輸出會比輸入大很多倍
+        if ((size_t)entry->len > out_end - out->len) return -2;
+        bytebuf_reserve(out, (size_t)entry->len);
+        memcpy(out->data + out->len, entry->bytes, (size_t)entry->len);
+        out->len += (size_t)entry->len;
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef CODER_H
+#define CODER_H
+
+#include <stddef.h>
+#include "codebook.h"
+#include "tokenizer.h"
+
+/* code 最長幾個 bit（bit writer 用 64-bit 累加器） */
+#define CODER_MAX_CODE_LEN 56
+
+/* 可重複使用的 byte buffer：len 之後的空間可以一直沿用，不必每次 malloc */
+typedef struct {
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+} ByteBuf;
+
+/* 確保 len 之後至少還有 extra 個 byte 可寫 */
+void bytebuf_reserve(ByteBuf *b, size_t extra);
+void bytebuf_free(ByteBuf *b);
+
+/* 載入後常駐記憶體的 codebook：編碼用的 code 表、token 字典與解碼查表 */
+typedef struct {
+    Codebook cb;
+    DecodeTable dtable;
+    TokenVocab vocab;
+    unsigned long long *code_bits;   /* symbol -> code，靠右對齊 */
+    unsigned char *code_len;         /* symbol -> code 長度，0 表示沒有這個 symbol */
+} Coder;
+
+/* 成功回傳 0，檔案打不開回傳 -1，codebook 不合法回傳 -2 */
+int coder_load(Coder *c, const char *filename);
+void coder_free(Coder *c);
+
+/* 把 in 編碼後接在 out 後面，格式與 encoder 輸出的 encoded.bin 相同（含 EOF）。
+   成功回傳 0，輸入裡有 codebook 沒有的 symbol 回傳 -1 */
+int coder_encode(const Coder *c, const unsigned char *in, size_t in_len, ByteBuf *out);
+
+/* 把 in 解碼後接在 out 後面，碰到 EOF symbol 才算成功回傳 0；
+   碰到非法 code，或資料在 EOF symbol 之前就結束，回傳 -1；
+   解出的資料超過 max_out 個 byte 時停下來回傳 -2，不會先配置超過上限的空間 */
+int coder_decode(const Coder *c, const unsigned char *in, size_t in_len, size_t max_out, ByteBuf *out);
+
+#endif /* CODER_H */
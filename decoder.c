@@ -2,93 +2,100 @@
 #include <stdlib.h>
 #include <string.h>
 #include "logger.h"
+#include "codebook.h"
+#include "block.h"
 
-#define MAX_SYMBOLS 256
-#define EOF_SYMBOL 255
-
-typedef struct Node {
-    int sym;               // -1 表示非葉節點
-    struct Node *left;
-    struct Node *right;
-} Node;
+/* ----------------- bit 讀取 ----------------- */
 
 typedef struct {
-    int sym;
-    char code[128];
-} Entry;
-
-/* ----------------- 解析 symbol 字串 ----------------- */
-
-int parse_symbol(const char *s) {
-    if (strcmp(s, "\\n") == 0) return '\n';
-    if (strcmp(s, "\\r") == 0) return '\r';
-    if (strcmp(s, "EOF") == 0)  return EOF_SYMBOL;
-
-    if (strncmp(s, "0x", 2) == 0) {
-        unsigned int val;
-        if (sscanf(s, "0x%X", &val) == 1) return (int)val;
+    FILE *f;
+    unsigned long long buf;   // 靠左對齊，最高位是下一個 bit
+    int nbits;                // buf 裡的有效 bit 數
+} BitReader;
+
+static void br_fill(BitReader *br) {
+    while (br->nbits <= 56) {
+        int c = fgetc(br->f);
+        if (c == EOF) break;
+        br->buf |= (unsigned long long)(unsigned char)c << (56 - br->nbits);
+        br->nbits += 8;
     }
+}
 
-    if (strlen(s) == 1) return (unsigned char)s[0];
+static unsigned int br_peek(const BitReader *br, int k) {
+    return (unsigned int)(br->buf >> (64 - k));
+}
 
-    // 無法解析的就略過
-    return -1;
+static void br_consume(BitReader *br, int k) {
+    br->buf <<= k;
+    br->nbits -= k;
 }
 
-/* ----------------- Huffman tree 操作 ----------------- */
+/* ----------------- 分塊格式 ----------------- */
 
-Node *new_node(int sym) {
-    Node *n = (Node *)malloc(sizeof(Node));
-    if (!n) {
-        fprintf(stderr, "malloc failed\n");
-        exit(1);
+/* 逐 block 讀進來解碼，記憶體用量只跟 block 大小有關。
+   成功回傳 0，格式錯誤回傳 -1 */
+int decode_blocks(FILE *fenc, FILE *fout, unsigned long long *num_decoded, unsigned long long *num_blocks) {
+    unsigned char file_header[BLOCK_FILE_HEADER_SIZE];
+    if (fread(file_header, 1, BLOCK_FILE_HEADER_SIZE, fenc) != BLOCK_FILE_HEADER_SIZE ||
+        memcmp(file_header, BLOCK_MAGIC, 4) != 0 || file_header[4] != BLOCK_VERSION) {
+        log_error("decoder", "invalid_block_stream reason=bad_file_header");
+        return -1;
     }
-    n->sym = sym;
-    n->left = n->right = NULL;
-    return n;
-}
 
-void insert_code(Node *root, const char *code, int sym) {
-    Node *curr = root;
-    for (int i = 0; code[i]; i++) {
-        if (code[i] == '0') {
-            if (!curr->left) curr->left = new_node(-1);
-            curr = curr->left;
-        } else if (code[i] == '1') {
-            if (!curr->right) curr->right = new_node(-1);
-            curr = curr->right;
-        } else {
-            fprintf(stderr, "invalid code char: %c\n", code[i]);
-            exit(1);
-        }
-    }
-    curr->sym = sym;
-}
+    unsigned char *in = NULL, *out = NULL;
+    size_t in_cap = 0, out_cap = 0;
+    int status = 0;
 
-void free_tree(Node *root) {
-    if (!root) return;
-    free_tree(root->left);
-    free_tree(root->right);
-    free(root);
-}
+    for (;;) {
+        unsigned char header[BLOCK_HEADER_SIZE];
+        unsigned char lengths[BLOCK_NUM_SYMBOLS];
+        unsigned int raw_len, data_len;
 
-/* ----------------- bit 讀取 ----------------- */
+        if (fread(header, 1, BLOCK_HEADER_SIZE, fenc) != BLOCK_HEADER_SIZE) {
+            log_error("decoder", "invalid_block_stream block=%llu reason=truncated_header", *num_blocks);
+            status = -1;
+            break;
+        }
+        block_read_header(header, &raw_len, &data_len, lengths);
+        if (raw_len == 0) break;   // 結束 block
 
-int read_bit(FILE *f) {
-    static int bits_left = 0;
-    static unsigned char byte = 0;
+        if (raw_len > BLOCK_MAX_SIZE || data_len > block_max_encoded(raw_len)) {
+            log_error("decoder", "invalid_block_stream block=%llu reason=bad_block_size", *num_blocks);
+            status = -1;
+            break;
+        }
+        if (data_len > in_cap) {
+            in_cap = data_len;
+            in = (unsigned char *)realloc(in, in_cap);
+        }
+        if (raw_len > out_cap) {
+            out_cap = raw_len;
+            out = (unsigned char *)realloc(out, out_cap);
+        }
+        if ((data_len > 0 && !in) || !out) {
+            fprintf(stderr, "malloc failed\n");
+            exit(1);
+        }
 
-    if (bits_left == 0) {
-        int c = fgetc(f);
-        if (c == EOF) return -1;
-        byte = (unsigned char)c;
-        bits_left = 8;
+        if (fread(in, 1, data_len, fenc) != data_len) {
+            log_error("decoder", "invalid_block_stream block=%llu reason=truncated_data", *num_blocks);
+            status = -1;
+            break;
+        }
+        if (block_decode(in, data_len, lengths, out, raw_len) != 0) {
+            log_error("decoder", "invalid_block_stream block=%llu reason=invalid_codeword", *num_blocks);
+            status = -1;
+            break;
+        }
+        fwrite(out, 1, raw_len, fout);
+        *num_decoded += raw_len;
+        (*num_blocks)++;
     }
 
-    int bit = (byte >> 7) & 1;
-    byte <<= 1;
-    bits_left--;
-    return bit;
+    free(in);
+    free(out);
+    return status;
 }
 
 /* ----------------- main ----------------- */
@@ -118,50 +125,72 @@ int main(int argc, char **argv) {
              enc_fn, cb_fn, out_fn);
 
     /* 讀 codebook.csv */
-    FILE *fcb = fopen(cb_fn, "r");
-    if (!fcb) {
+    Codebook cb;
+    if (codebook_load(cb_fn, &cb) != 0) {
         log_error("decoder", "cannot_open_codebook codebook=%s", cb_fn);
         log_error("decoder", "finish status=error");
         if (logf) fclose(logf);
         return 1;
     }
+    int entry_count = cb.num_entries;
 
-    Entry table[MAX_SYMBOLS];
-    int entry_count = 0;
-    char line[256];
-
-    while (fgets(line, sizeof(line), fcb)) {
-        char symbol_str[32], code[128];
-        unsigned long count;
-        double prob, self_info;
-
-        if (sscanf(line, "\"%[^\"]\",%lu,%lf,\"%[^\"]\",%lf",
-                   symbol_str, &count, &prob, code, &self_info) == 5) {
-            int s = parse_symbol(symbol_str);
-            if (s == -1) continue;
-            table[entry_count].sym = s;
-            strcpy(table[entry_count].code, code);
-            entry_count++;
+    log_info("decoder",
+             "load_codebook entries=%d format=%s",
+             entry_count, cb.block_format ? "blocks" : "global");
+
+    if (cb.block_format) {
+        /* 分塊格式：code 長度都在 encoded.bin 的 block header 裡 */
+        codebook_free(&cb);
+        FILE *fenc = fopen(enc_fn, "rb");
+        FILE *fout = fenc ? fopen(out_fn, "wb") : NULL;
+        if (!fenc || !fout) {
+            log_error("decoder", "cannot_open_file encoded=%s output=%s", enc_fn, out_fn);
+            if (fenc) fclose(fenc);
+            log_error("decoder", "finish status=error");
+            if (logf) fclose(logf);
+            return 1;
         }
-    }
-    fclose(fcb);
 
-    log_info("decoder",
-             "load_codebook entries=%d",
-             entry_count);
+        unsigned long long num_decoded = 0, num_blocks = 0;
+        log_info("decoder", "decode_blocks begin");
+        int rc = decode_blocks(fenc, fout, &num_decoded, &num_blocks);
+        fclose(fenc);
+        fclose(fout);
+
+        log_info("decoder",
+                 "decode_blocks done output_file=%s num_blocks=%llu num_decoded_symbols=%llu",
+                 out_fn, num_blocks, num_decoded);
+        log_info("metrics",
+                 "summary input_encoded=%s input_codebook=%s output_file=%s "
+                 "num_decoded_symbols=%llu output_bytes=%llu num_blocks=%llu peak_rss_kb=%ld status=%s",
+                 enc_fn, cb_fn, out_fn, num_decoded, num_decoded, num_blocks, peak_rss_kb(),
+                 rc == 0 ? "ok" : "error");
+        log_info("decoder", "finish status=%s", rc == 0 ? "ok" : "error");
+        if (logf) fclose(logf);
+        return rc == 0 ? 0 : 1;
+    }
 
-    /* 建 Huffman tree */
-    Node *root = new_node(-1);
-    for (int i = 0; i < entry_count; i++) {
-        insert_code(root, table[i].code, table[i].sym);
+    /* 建多層查表（與 huffd、gen_decoder 共用 codebook_build_table） */
+    DecodeTable dt;
+    int root_bits_max = (cb.table_bits > 0) ? cb.table_bits : DTABLE_ROOT_BITS_MAX;
+    int rc = codebook_build_table(&cb, root_bits_max, &dt);
+    if (rc != 0) {
+        log_error("decoder", "%s codebook=%s",
+                  (rc == -1) ? "invalid_code_char" : "codes_not_prefix_free", cb_fn);
+        codebook_free(&cb);
+        log_error("decoder", "finish status=error");
+        if (logf) fclose(logf);
+        return 1;
     }
-    log_info("decoder", "build_tree done");
+    log_info("decoder", "build_table done root_bits=%d max_code_len=%d table_size=%lu",
+             dt.root_bits, dt.max_code_len, (unsigned long)dt.size);
 
     /* 開啟 encoded.bin + output.txt */
     FILE *fenc = fopen(enc_fn, "rb");
     if (!fenc) {
         log_error("decoder", "cannot_open_encoded_file encoded=%s", enc_fn);
-        free_tree(root);
+        decode_table_free(&dt);
+        codebook_free(&cb);
         log_error("decoder", "finish status=error");
         if (logf) fclose(logf);
         return 1;
@@ -171,60 +200,96 @@ int main(int argc, char **argv) {
     if (!fout) {
         log_error("decoder", "cannot_open_output_file output=%s", out_fn);
         fclose(fenc);
-        free_tree(root);
+        decode_table_free(&dt);
+        codebook_free(&cb);
         log_error("decoder", "finish status=error");
         if (logf) fclose(logf);
         return 1;
     }
 
     /* 解碼 bitstream */
-    Node *curr = root;
-    int bit;
-    unsigned long num_decoded = 0;
-    unsigned long bit_pos = 0;
+    BitReader br = { fenc, 0, 0 };
+    unsigned long long num_decoded = 0;
+    unsigned long long output_bytes = 0;
+    unsigned long long bit_pos = 0;
 
     log_info("decoder", "decode_bitstream begin");
 
-    while ((bit = read_bit(fenc)) != -1) {
-        bit_pos++;
-        curr = (bit == 0) ? curr->left : curr->right;
+    int seen_eof = 0;
+    int invalid = 0;
+    for (;;) {
+        br_fill(&br);
+        if (br.nbits == 0) break;
+
+        int w = dt.root_bits;
+        unsigned int e = dt.data[br_peek(&br, w)];
+        int truncated = 0;
+        while (e & DTABLE_LINK_FLAG) {
+            // code 比這一層長，往下一層子表
+            if (w > br.nbits) {
+                truncated = 1;
+                break;
+            }
+            br_consume(&br, w);
+            bit_pos += (unsigned long long)w;
+            br_fill(&br);
+            w = (int)(e & 0xFFu);
+            e = dt.data[((e >> 8) & DTABLE_INDEX_MASK) + br_peek(&br, w)];
+        }
+        if (truncated) break;   // bitstream 在 code 中間結束
 
-        if (!curr) {
+        int len = (int)(e & 0xFFu);
+        unsigned int sym = (e >> 8) & DTABLE_INDEX_MASK;
+        if (len > br.nbits) break;   // 剩下的 bit 湊不成完整的 code
+
+        if (sym == DTABLE_INVALID_SYMBOL) {
             log_error("decoder",
-                      "invalid_codeword bit_position=%lu reason=unexpected_prefix",
+                      "invalid_codeword bit_position=%llu reason=unexpected_prefix",
                       bit_pos);
-            curr = root;
-            continue;
+            invalid = 1;
+            break;
         }
-
-        if (curr->sym != -1) {   // 走到葉節點
-            if (curr->sym == EOF_SYMBOL) {
-                // 碰到 EOF symbol，正常結束
-                break;
-            }
-            fputc(curr->sym, fout);
-            num_decoded++;
-            curr = root;
+        br_consume(&br, len);
+        bit_pos += (unsigned long long)len;
+
+        const CodebookEntry *out = &cb.entries[sym];
+        if (out->sym == EOF_SYMBOL) {
+            // 碰到 EOF symbol，正常結束
+            seen_eof = 1;
+            break;
         }
+        if (out->len == 1) {
+            fputc(out->bytes[0], fout);
+        } else {
+            fwrite(out->bytes, 1, (size_t)out->len, fout);
+        }
+        output_bytes += (unsigned long long)out->len;
+        num_decoded++;
+    }
+    if (!seen_eof && !invalid) {
+        // 沒有碰到 EOF symbol 資料就沒了，encoded.bin 被截斷
+        log_error("decoder", "invalid_bitstream bit_position=%llu reason=truncated", bit_pos);
     }
+    const char *status = seen_eof ? "ok" : "error";
 
     fclose(fenc);
     fclose(fout);
-    free_tree(root);
+    decode_table_free(&dt);
+    codebook_free(&cb);
 
     log_info("decoder",
-             "decode_bitstream done output_file=%s num_decoded_symbols=%lu",
-             out_fn, num_decoded);
+             "decode_bitstream done output_file=%s num_decoded_symbols=%llu output_bytes=%llu",
+             out_fn, num_decoded, output_bytes);
 
     log_info("metrics",
              "summary input_encoded=%s input_codebook=%s output_file=%s "
-             "num_decoded_symbols=%lu status=ok",
-             enc_fn, cb_fn, out_fn, num_decoded);
+             "num_decoded_symbols=%llu output_bytes=%llu peak_rss_kb=%ld status=%s",
+             enc_fn, cb_fn, out_fn, num_decoded, output_bytes, peak_rss_kb(), status);
 
-    log_info("decoder", "finish status=ok");
+    log_info("decoder", "finish status=%s", status);
 
     if (logf) fclose(logf);
-    return 0;
+    return seen_eof ? 0 : 1;
 }
 
 //trigger workflow
\ No newline at end of file
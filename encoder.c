@@ -2,44 +2,186 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
+#include <sys/stat.h>
 #include "logger.h"
+#include "tokenizer.h"
+#include "block.h"
 
-#define MAX_SYMBOLS 256
 #define MAX_CODE_LEN 128
 
+/* 分塊模式的預設 block 大小，以及由記憶體預算推算 block 大小時的範圍 */
+#define DEFAULT_BLOCK_SIZE (1u << 20)
+#define MIN_BLOCK_SIZE     (64u << 10)
+/* 除了 block buffer 以外的固定記憶體（程式本身、stdio、log 等）估計值 */
+#define FIXED_MEMORY       (4u << 20)
+/* -m 至少要放得下固定開銷加上一個最小 block 的輸入與輸出 buffer */
+#define MIN_MEMORY_BUDGET  (FIXED_MEMORY + 3ull * MIN_BLOCK_SIZE)
+
+/* 整份檔案模式一次讀 / 寫的大小 */
+#define IO_BUF_SIZE        (64u << 10)
+
+/* 壓縮等級 -1 .. -9：越小越快，越大壓縮率越好。
+   -1 是分塊模式，只讀一遍（block 大小對速度、壓縮率幾乎沒影響，所以只留一級）；
+   -2 是整份檔案一份 codebook（原本的預設），要讀兩遍；
+   -3 ~ -9 再加上 token：字典越大輸出的 symbol 越少、編碼反而越快，所以都用滿 MAX_TOKENS 個，
+   改由看多少資料來換時間，每一級看的資料都包含前一級。以切一遍 token 的時間 F 來算：
+   -3 ~ -6 訓練與出現次數都只看檔案開頭 1/16 ~ 6/16（次數是估計值），約 1.1F ~ 1.75F；
+   -7 ~ -9 出現次數數整個檔案，訓練看 6/16、10/16、全部，約 2.4F ~ 3F。
+   code 長度上限不隨等級變：分塊格式固定 BLOCK_MAX_CODE_LEN，整份檔案模式不限制 */
 typedef struct {
-    unsigned char sym;
-    unsigned long count;
+    unsigned int block_size;   /* 0 表示整個檔案共用一份 codebook */
+    int table_bits;            /* 寫進 codebook 的 decoder 第一層查表寬度，分塊模式不用 */
+    int num_tokens;            /* token 訓練數量，0 表示只用 byte */
+    int train_part;            /* token 從檔案開頭的幾 / 16 訓練，16 表示整個檔案 */
+    int count_part;            /* 出現次數數檔案開頭的幾 / 16，16 表示整個檔案 */
+} LevelPreset;
+
+#define DEFAULT_LEVEL 2
+
+static const LevelPreset level_presets[10] = {
+    /*        block_size  table_bits num_tokens  train_part count_part */
+    [1] = { 4u << 20,          0,        0,          16,        16 },
+    [2] = { 0,                11,        0,          16,        16 },
+    [3] = { 0,                12,   MAX_TOKENS,       1,         1 },
+    [4] = { 0,                12,   MAX_TOKENS,       2,         2 },
+    [5] = { 0,                12,   MAX_TOKENS,       4,         4 },
+    [6] = { 0,                12,   MAX_TOKENS,       6,         6 },
+    [7] = { 0,                12,   MAX_TOKENS,       6,        16 },
+    [8] = { 0,                12,   MAX_TOKENS,      10,        16 },
+    [9] = { 0,                12,   MAX_TOKENS,      16,        16 },
+};
+
+typedef struct {
+    int sym;
+    unsigned long long count;
     double prob;
     char code[MAX_CODE_LEN];
     double self_info;
 } SymbolEntry;
 
-typedef struct HuffmanNode {
-    unsigned char sym;
-    unsigned long count;
-    struct HuffmanNode *left;
-    struct HuffmanNode *right;
+/* 樹的節點放在一個連續陣列裡：前 n 個是葉節點，之後依合併順序放內部節點，
+   left/right 是陣列 index，葉節點為 -1 */
+typedef struct {
+    int sym;
+    unsigned long long count;
+    int left;
+    int right;
 } HuffmanNode;
 
 // ----------------- Function prototypes -----------------
-void count_symbols(const char *filename, SymbolEntry *symbols, int *num_symbols, unsigned long *total_symbols);
-HuffmanNode* build_huffman_tree(SymbolEntry *symbols, int num_symbols);
-void generate_code(HuffmanNode *node, char *code, int depth, SymbolEntry *symbols, int num_symbols);
-void write_codebook(SymbolEntry *symbols, int num_symbols, const char *filename);
-void encode_file(const char *input_file, const char *output_file, SymbolEntry *symbols, int num_symbols);
-void free_huffman_tree(HuffmanNode *node);
+int count_symbols(const char *filename, const TokenVocab *vocab, unsigned long long sample_bytes,
+                  SymbolEntry *symbols, int *num_symbols,
+                  unsigned long long *total_symbols, unsigned long long *total_bytes);
+int histogram_to_symbols(const unsigned long long *hist, int hist_size, SymbolEntry *symbols,
+                         unsigned long long *total);
+int build_huffman_tree(const SymbolEntry *symbols, int num_symbols, HuffmanNode *nodes);
+void generate_code(const HuffmanNode *nodes, int root, SymbolEntry *symbols);
+void write_codebook(SymbolEntry *symbols, int num_symbols, const TokenVocab *vocab,
+                    const char *header, const char *filename);
+void encode_file(const char *input_file, const char *output_file, const TokenVocab *vocab,
+                 SymbolEntry *symbols, int num_symbols,
+                 unsigned long long *total_bytes, unsigned long long *total_symbols,
+                 unsigned long long *encoded_bits, unsigned long long *emitted);
+void huffman_code_lengths(const unsigned long long *hist, unsigned char *lengths);
+void encode_blocks(FILE *fin, const char *output_file, size_t block_size,
+                   unsigned long long *hist,
+                   unsigned long long *total_bytes, unsigned long long *encoded_bytes,
+                   unsigned long long *num_blocks);
 
 // ----------------- Main -----------------
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-1..-9] [-t num_tokens] [-b block_size] [-m memory_budget] "
+            "input.txt codebook.csv encoded.bin\n", prog);
+    fprintf(stderr, "  -1 .. -9         compression level, faster to smaller (default -%d)\n", DEFAULT_LEVEL);
+    fprintf(stderr, "  -t num_tokens    train a word/byte-pair alphabet of up to %d tokens (default set by level, 0 = bytes only)\n",
+            MAX_TOKENS);
+    fprintf(stderr, "  -b block_size    single-pass chunked encoding with a codebook per block (e.g. 1M)\n");
+    fprintf(stderr, "  -m memory_budget chunked encoding with block size chosen to fit the budget (e.g. 64M, at least %lluK)\n",
+            MIN_MEMORY_BUDGET >> 10);
+    fprintf(stderr, "  input.txt may be - to read stdin (implies chunked encoding)\n");
+}
+
+/* 解析 "123"、"64K"、"16M"、"2G" 這類大小，失敗回傳 0 */
+static unsigned long long parse_size(const char *s) {
+    char *end;
+    unsigned long long v = strtoull(s, &end, 10);
+    if (end == s) return 0;
+    if (*end == 'K' || *end == 'k') { v <<= 10; end++; }
+    else if (*end == 'M' || *end == 'm') { v <<= 20; end++; }
+    else if (*end == 'G' || *end == 'g') { v <<= 30; end++; }
+    return (*end == '\0') ? v : 0;
+}
+
+/* 檔案開頭的 part / 16 換成 byte 數，0 表示整個檔案 */
+static unsigned long long sample_size(unsigned long long file_size, int part) {
+    if (part >= 16) return 0;
+    unsigned long long n = file_size / 16 * (unsigned long long)part;
+    return (n > 0 && n < file_size) ? n : 0;
+}
+
+/* 從 t0 到現在經過的秒數 */
+static double elapsed_sec(const struct timespec *t0) {
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (double)(t1.tv_sec - t0->tv_sec) + (double)(t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+/* 每秒處理多少 MB 的輸入 */
+static double throughput_mb_s(unsigned long long bytes, double sec) {
+    return (sec > 0.0) ? (double)bytes / 1e6 / sec : 0.0;
+}
+
+static int run_block_mode(const char *input_file, const char *codebook_file, const char *encoded_file,
+                          size_t block_size, unsigned long long memory_budget, int level,
+                          const struct timespec *t0);
+
 int main(int argc, char *argv[]) {
-    if (argc != 4) {
-        fprintf(stderr, "Usage: %s input.txt codebook.csv encoded.bin\n", argv[0]);
+    int level = DEFAULT_LEVEL;
+    int num_tokens = -1;   // -1 表示照壓縮等級，0 表示只用 byte alphabet
+    unsigned long long block_size = 0;      // 0 表示整個檔案共用一份 codebook
+    unsigned long long memory_budget = 0;   // 0 表示不限制
+    int argi = 1;
+
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    while (argi < argc && argv[argi][0] == '-' && argv[argi][1] != '\0') {
+        if (argv[argi][1] >= '1' && argv[argi][1] <= '9' && argv[argi][2] == '\0') {
+            level = argv[argi][1] - '0';
+            argi++;
+        } else if (strcmp(argv[argi], "-t") == 0 && argi + 1 < argc) {
+            num_tokens = atoi(argv[argi + 1]);
+            if (num_tokens < 0) num_tokens = 0;
+            if (num_tokens > MAX_TOKENS) num_tokens = MAX_TOKENS;
+            argi += 2;
+        } else if (strcmp(argv[argi], "-b") == 0 && argi + 1 < argc) {
+            block_size = parse_size(argv[argi + 1]);
+            if (block_size == 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            argi += 2;
+        } else if (strcmp(argv[argi], "-m") == 0 && argi + 1 < argc) {
+            memory_budget = parse_size(argv[argi + 1]);
+            if (memory_budget == 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            argi += 2;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - argi != 3) {
+        usage(argv[0]);
         return 1;
     }
 
-    const char *input_file    = argv[1];
-    const char *codebook_file = argv[2];
-    const char *encoded_file  = argv[3];
+    const char *input_file    = argv[argi];
+    const char *codebook_file = argv[argi + 1];
+    const char *encoded_file  = argv[argi + 2];
 
     /* 初始化 logger，輸出到 encoder.log */
     log_init(NULL, NULL);
@@ -52,108 +194,380 @@ int main(int argc, char *argv[]) {
         log_error("encoder", "cannot_open_log_file encoder.log, fallback to stdout/stderr");
     }
 
+    const LevelPreset *preset = &level_presets[level];
+
     log_info("encoder",
-             "start input_file=%s codebook_file=%s encoded_file=%s",
-             input_file, codebook_file, encoded_file);
+             "start input_file=%s codebook_file=%s encoded_file=%s level=%d num_tokens=%d",
+             input_file, codebook_file, encoded_file, level,
+             num_tokens >= 0 ? num_tokens : preset->num_tokens);
+
+    /* 分塊模式：只讀一遍輸入（可以是 stdin），記憶體用量固定 */
+    if (block_size > 0 || memory_budget > 0 || preset->block_size > 0 || strcmp(input_file, "-") == 0) {
+        if (num_tokens > 0) {
+            log_error("encoder", "token_alphabet_requires_global_mode num_tokens=%d", num_tokens);
+            log_error("encoder", "finish status=error");
+            if (logf) fclose(logf);
+            return 1;
+        }
+        if (num_tokens < 0 && preset->num_tokens > 0) {
+            log_warn("encoder", "level_tokens_skipped_in_block_mode level=%d", level);
+        }
+        // 等級只決定預設值，-b / -m 有給就照使用者的
+        if (block_size == 0) block_size = preset->block_size;
+        int rc = run_block_mode(input_file, codebook_file, encoded_file,
+                                (size_t)block_size, memory_budget, level, &t0);
+        if (logf) fclose(logf);
+        return rc;
+    }
+    if (num_tokens < 0) num_tokens = preset->num_tokens;
+
+    struct stat st;
+    unsigned long long file_size = (stat(input_file, &st) == 0) ? (unsigned long long)st.st_size : 0;
+    unsigned long long train_bytes = sample_size(file_size, preset->train_part);
+    unsigned long long count_bytes = sample_size(file_size, preset->count_part);
+
+    /* token 模式：先掃一遍挑出常見單字與 byte pair */
+    TokenVocab vocab;
+    vocab_init(&vocab, num_tokens);
+    if (num_tokens > 0) {
+        FILE *ftrain = fopen(input_file, "rb");
+        if (!ftrain) {
+            perror("fopen");
+            exit(1);
+        }
+        int trained = vocab_train(&vocab, ftrain, num_tokens, train_bytes);
+        fclose(ftrain);
+        log_info("encoder", "train_tokens done num_tokens=%d train_bytes=%llu", trained, train_bytes);
+    }
 
-    SymbolEntry symbols[MAX_SYMBOLS];
+    SymbolEntry *symbols = (SymbolEntry *)malloc(sizeof(SymbolEntry) * MAX_ALPHABET);
+    if (!symbols) {
+        fprintf(stderr, "malloc failed\n");
+        exit(1);
+    }
     int num_symbols = 0;
-    unsigned long total_symbols = 0;
+    unsigned long long total_symbols = 0;
+    unsigned long long total_bytes = 0;
 
-    count_symbols(input_file, symbols, &num_symbols, &total_symbols);
+    int sampled = count_symbols(input_file, &vocab, count_bytes, symbols, &num_symbols,
+                                &total_symbols, &total_bytes);
     if (num_symbols == 0) {
         log_error("encoder", "no_symbols_found input_file=%s", input_file);
         log_error("encoder", "finish status=error");
+        free(symbols);
+        vocab_free(&vocab);
         if (logf) fclose(logf);
         return 1;
     }
 
     log_info("encoder",
-             "histogram_built num_symbols=%d total_symbols=%lu",
-             num_symbols, total_symbols);
+             "histogram_built num_symbols=%d total_symbols=%llu total_bytes=%llu sampled=%d",
+             num_symbols, total_symbols, total_bytes, sampled);
 
-    HuffmanNode *root = build_huffman_tree(symbols, num_symbols);
-    if (!root) {
-        log_error("encoder", "build_huffman_tree_failed");
-        log_error("encoder", "finish status=error");
-        if (logf) fclose(logf);
-        return 1;
+    HuffmanNode *nodes = (HuffmanNode *)malloc(sizeof(HuffmanNode) * (2 * num_symbols - 1));
+    if (!nodes) {
+        fprintf(stderr, "malloc failed\n");
+        exit(1);
     }
-
-    char code[MAX_CODE_LEN];
-    generate_code(root, code, 0, symbols, num_symbols);
+    int root = build_huffman_tree(symbols, num_symbols, nodes);
+    generate_code(nodes, root, symbols);
+    free(nodes);
     log_info("encoder",
              "codebook_generated num_symbols=%d",
              num_symbols);
 
-    write_codebook(symbols, num_symbols, codebook_file);
+    // table_bits 給 decoder 參考，舊版 decoder 會略過這一列
+    char header[64];
+    sprintf(header, "# level=%d table_bits=%d", level, preset->table_bits);
+    write_codebook(symbols, num_symbols, &vocab, header, codebook_file);
     log_info("encoder",
              "write_codebook done file=%s",
              codebook_file);
 
-    encode_file(input_file, encoded_file, symbols, num_symbols);
+    /* sampled 時 histogram 只是估計（還加了 1），entropy 改用實際寫出的 symbol 來算 */
+    unsigned long long *emitted = NULL;
+    if (sampled) {
+        emitted = (unsigned long long *)calloc(MAX_ALPHABET, sizeof(unsigned long long));
+        if (!emitted) {
+            fprintf(stderr, "malloc failed\n");
+            exit(1);
+        }
+    }
+    unsigned long long encoded_bits = 0;
+    encode_file(input_file, encoded_file, &vocab, symbols, num_symbols,
+                &total_bytes, &total_symbols, &encoded_bits, emitted);
     log_info("encoder",
              "encode_file done encoded_file=%s",
              encoded_file);
 
     /* ---- metrics summary ---- */
     double entropy = 0.0;
-    double avg_code_len = 0.0;
-    unsigned long encoded_bits = 0;
+    if (emitted) {
+        for (int i = 0; i < MAX_ALPHABET; i++) {
+            if (emitted[i] == 0) continue;
+            double p = (double)emitted[i] / (double)total_symbols;
+            entropy -= p * log2(p);
+        }
+        free(emitted);
+    } else {
+        for (int i = 0; i < num_symbols; i++) {
+            entropy += symbols[i].prob * symbols[i].self_info;      // bits
+        }
+    }
+    double avg_code_len = (total_symbols > 0) ? (double)encoded_bits / (double)total_symbols : 0.0;
+    unsigned long long original_bits = total_bytes * 8ULL;
+    double compression_ratio = (original_bits > 0)
+                               ? (double)encoded_bits / (double)original_bits
+                               : 0.0;
+
+    double sec = elapsed_sec(&t0);
 
+    log_info("metrics",
+             "summary input_file=%s codebook_file=%s encoded_file=%s "
+             "total_symbols=%llu num_unique_symbols=%d num_tokens=%d entropy=%.6f "
+             "avg_code_length=%.6f original_bits=%llu encoded_bits=%llu "
+             "compression_ratio=%.6f level=%d mode=global table_bits=%d "
+             "elapsed_sec=%.3f throughput_mb_s=%.2f peak_rss_kb=%ld status=ok",
+             input_file, codebook_file, encoded_file,
+             total_symbols, num_symbols, vocab.num_tokens,
+             entropy, avg_code_len,
+             original_bits, encoded_bits,
+             compression_ratio, level, preset->table_bits,
+             sec, throughput_mb_s(total_bytes, sec), peak_rss_kb());
+
+    log_info("encoder", "finish status=ok");
+
+    free(symbols);
+    vocab_free(&vocab);
+    if (logf) fclose(logf);
+    return 0;
+}
+
+static int run_block_mode(const char *input_file, const char *codebook_file, const char *encoded_file,
+                          size_t block_size, unsigned long long memory_budget, int level,
+                          const struct timespec *t0) {
+    /* 記憶體預算：輸入 block + 最壞情況的輸出 buffer（約 2 倍）+ 固定開銷 */
+    if (memory_budget > 0) {
+        unsigned long long fit = (memory_budget > FIXED_MEMORY) ? (memory_budget - FIXED_MEMORY) / 3 : 0;
+        if (fit < MIN_BLOCK_SIZE) {
+            // 連最小的 block 都放不下，不要默默超過使用者給的上限
+            log_error("encoder", "memory_budget_too_small memory_budget=%llu min_memory_budget=%llu",
+                      memory_budget, MIN_MEMORY_BUDGET);
+            log_error("encoder", "finish status=error");
+            return 1;
+        }
+        if (block_size == 0 || block_size > fit) block_size = (size_t)fit;
+    }
+    if (block_size == 0) block_size = DEFAULT_BLOCK_SIZE;
+    if (block_size > BLOCK_MAX_SIZE) block_size = BLOCK_MAX_SIZE;
+
+    FILE *fin = (strcmp(input_file, "-") == 0) ? stdin : fopen(input_file, "rb");
+    if (!fin) {
+        log_error("encoder", "cannot_open_input_file input_file=%s", input_file);
+        log_error("encoder", "finish status=error");
+        return 1;
+    }
+
+    log_info("encoder", "block_mode block_size=%lu memory_budget=%llu max_code_len=%d",
+             (unsigned long)block_size, memory_budget, BLOCK_MAX_CODE_LEN);
+
+    unsigned long long hist[BLOCK_NUM_SYMBOLS] = {0};
+    unsigned long long total_bytes = 0, encoded_bytes = 0, num_blocks = 0;
+
+    encode_blocks(fin, encoded_file, block_size, hist, &total_bytes, &encoded_bytes, &num_blocks);
+    if (fin != stdin) fclose(fin);
+
+    log_info("encoder",
+             "encode_blocks done encoded_file=%s num_blocks=%llu",
+             encoded_file, num_blocks);
+
+    /* codebook.csv 只記錄整體統計，每個 block 的 code 長度在 encoded.bin 裡 */
+    SymbolEntry symbols[BLOCK_NUM_SYMBOLS];
+    unsigned long long total_symbols = 0;
+    int num_symbols = histogram_to_symbols(hist, BLOCK_NUM_SYMBOLS, symbols, &total_symbols);
+    for (int i = 0; i < num_symbols; i++) strcpy(symbols[i].code, "-");
+
+    char header[96];
+    sprintf(header, "# format=blocks block_size=%lu level=%d max_code_len=%d",
+            (unsigned long)block_size, level, BLOCK_MAX_CODE_LEN);
+    write_codebook(symbols, num_symbols, NULL, header, codebook_file);
+    log_info("encoder",
+             "write_codebook done file=%s",
+             codebook_file);
+
+    /* ---- metrics summary ---- */
+    double entropy = 0.0;
     for (int i = 0; i < num_symbols; i++) {
-        int L = (int)strlen(symbols[i].code);
-        entropy       += symbols[i].prob * symbols[i].self_info;      // bits
-        avg_code_len  += symbols[i].prob * L;                         // bits/symbol
-        encoded_bits  += symbols[i].count * (unsigned long)L;         // total bits
+        entropy += symbols[i].prob * symbols[i].self_info;
     }
-    unsigned long original_bits = total_symbols * 8UL;
+    unsigned long long original_bits = total_bytes * 8ULL;
+    unsigned long long encoded_bits = encoded_bytes * 8ULL;
+    double avg_code_len = (total_symbols > 0) ? (double)encoded_bits / (double)total_symbols : 0.0;
     double compression_ratio = (original_bits > 0)
                                ? (double)encoded_bits / (double)original_bits
                                : 0.0;
 
+    double sec = elapsed_sec(t0);
+
     log_info("metrics",
              "summary input_file=%s codebook_file=%s encoded_file=%s "
-             "total_symbols=%lu num_unique_symbols=%d entropy=%.6f "
-             "avg_code_length=%.6f original_bits=%lu encoded_bits=%lu "
-             "compression_ratio=%.6f status=ok",
+             "total_symbols=%llu num_unique_symbols=%d num_tokens=0 entropy=%.6f "
+             "avg_code_length=%.6f original_bits=%llu encoded_bits=%llu "
+             "compression_ratio=%.6f level=%d mode=blocks max_code_len=%d "
+             "elapsed_sec=%.3f throughput_mb_s=%.2f "
+             "block_size=%lu num_blocks=%llu memory_budget=%llu peak_rss_kb=%ld status=ok",
              input_file, codebook_file, encoded_file,
              total_symbols, num_symbols,
              entropy, avg_code_len,
              original_bits, encoded_bits,
-             compression_ratio);
+             compression_ratio, level, BLOCK_MAX_CODE_LEN,
+             sec, throughput_mb_s(total_bytes, sec),
+             (unsigned long)block_size, num_blocks, memory_budget, peak_rss_kb());
 
     log_info("encoder", "finish status=ok");
-
-    free_huffman_tree(root);
-    if (logf) fclose(logf);
     return 0;
 }
 
 // ----------------- Functions -----------------
 
-void count_symbols(const char *filename, SymbolEntry *symbols, int *num_symbols, unsigned long *total_symbols) {
-    unsigned long hist[MAX_SYMBOLS] = {0};
+static void count_symbol(int sym, void *ctx) {
+    unsigned long long *hist = (unsigned long long *)ctx;
+    hist[sym]++;
+}
+
+/* sample_bytes > 0 時只數檔案開頭那麼多 byte；沒數完時每個 byte 與 token 都再加 1，
+   確保後面沒數到的 symbol 也有 code。回傳是否只數了一部分 */
+int count_symbols(const char *filename, const TokenVocab *vocab, unsigned long long sample_bytes,
+                  SymbolEntry *symbols, int *num_symbols,
+                  unsigned long long *total_symbols, unsigned long long *total_bytes) {
+    unsigned long long *hist = (unsigned long long *)calloc(MAX_ALPHABET, sizeof(unsigned long long));
+    if (!hist) {
+        fprintf(stderr, "malloc failed\n");
+        exit(1);
+    }
     FILE *f = fopen(filename, "rb");
     if (!f) {
         perror("fopen");
         exit(1);
     }
 
-    int c;
-    while ((c = fgetc(f)) != EOF) {
-        hist[(unsigned char)c]++;
+    unsigned long long bytes = 0;
+    int sampled = 0;
+    if (vocab && vocab->num_tokens > 0) {
+        PieceReader *r = (PieceReader *)malloc(sizeof(PieceReader));
+        if (!r) {
+            fprintf(stderr, "malloc failed\n");
+            exit(1);
+        }
+        TokenEncoder te;
+        const unsigned char *p;
+        int n;
+
+        piece_reader_init(r, f);
+        token_encoder_init(&te, vocab, count_symbol, hist);
+        while ((n = piece_reader_next(r, &p)) > 0) {
+            token_encoder_piece(&te, p, n);
+            bytes += (unsigned long long)n;
+            if (sample_bytes > 0 && bytes >= sample_bytes) {
+                sampled = 1;
+                break;
+            }
+        }
+        token_encoder_flush(&te);
+        free(r);
+    } else {
+        unsigned char buf[IO_BUF_SIZE];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+            for (size_t i = 0; i < n; i++) hist[buf[i]]++;
+            bytes += n;
+            if (sample_bytes > 0 && bytes >= sample_bytes) {
+                sampled = 1;
+                break;
+            }
+        }
     }
     fclose(f);
+    if (sampled) {
+        for (int i = 0; i < 256; i++) hist[i]++;
+        for (int i = 0; vocab && i < vocab->num_tokens; i++) hist[FIRST_TOKEN_SYMBOL + i]++;
+    }
 
-    // 加入 EOF symbol (使用 255)
-    hist[255] += 1;
+    // 加入 EOF symbol
+    hist[EOF_SYMBOL] += 1;
 
+    unsigned long long total = 0;
+    *num_symbols = histogram_to_symbols(hist, MAX_ALPHABET, symbols, &total);
+    free(hist);
+
+    *total_symbols = total;
+    *total_bytes = bytes;
+    return sampled;
+}
+
+/* 排序順序：count 遞增，count 一樣時看 sym */
+static int symbol_before(unsigned long long ca, int sa, unsigned long long cb, int sb) {
+    return ca < cb || (ca == cb && sa < sb);
+}
+
+/* heapsort：O(n log n) 而且不配置記憶體（qsort 在大陣列時可能會 malloc） */
+static void sift_down_symbols(SymbolEntry *a, int i, int n) {
+    SymbolEntry tmp = a[i];
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= n) break;
+        if (child + 1 < n && symbol_before(a[child].count, a[child].sym, a[child + 1].count, a[child + 1].sym)) {
+            child++;
+        }
+        if (!symbol_before(tmp.count, tmp.sym, a[child].count, a[child].sym)) break;
+        a[i] = a[child];
+        i = child;
+    }
+    a[i] = tmp;
+}
+
+static void sort_symbols(SymbolEntry *a, int n) {
+    for (int i = n / 2 - 1; i >= 0; i--) sift_down_symbols(a, i, n);
+    for (int end = n - 1; end > 0; end--) {
+        SymbolEntry tmp = a[0];
+        a[0] = a[end];
+        a[end] = tmp;
+        sift_down_symbols(a, 0, end);
+    }
+}
+
+/* 分塊模式用，key 是 (count << 8) | byte，最多 BLOCK_NUM_SYMBOLS 個。
+   key 是依 byte 順序放進來的，所以只要對 count 的各個 byte 做穩定的 LSD radix sort，
+   count 一樣時自然照 byte 排；沒有比較分支，暫存陣列放在 stack 上 */
+static void sort_keys(unsigned long long *a, int n) {
+    unsigned long long tmp[BLOCK_NUM_SYMBOLS];
+    unsigned long long max = 0;
+    for (int i = 0; i < n; i++) {
+        if (a[i] > max) max = a[i];
+    }
+
+    for (int shift = 8; shift < 64 && (max >> shift) != 0; shift += 8) {
+        int pos[256] = {0};
+        for (int i = 0; i < n; i++) pos[(a[i] >> shift) & 0xFF]++;
+        int sum = 0;
+        for (int d = 0; d < 256; d++) {
+            int c = pos[d];
+            pos[d] = sum;
+            sum += c;
+        }
+        for (int i = 0; i < n; i++) tmp[pos[(a[i] >> shift) & 0xFF]++] = a[i];
+        memcpy(a, tmp, sizeof(unsigned long long) * (size_t)n);
+    }
+}
+
+/* 把 histogram 裡出現過的 symbol 填進 symbols[]，依 count 遞增排序，回傳 symbol 數 */
+int histogram_to_symbols(const unsigned long long *hist, int hist_size, SymbolEntry *symbols,
+                         unsigned long long *total_symbols) {
     int n = 0;
-    unsigned long total = 0;
-    for (int i = 0; i < MAX_SYMBOLS; i++) {
+    unsigned long long total = 0;
+    for (int i = 0; i < hist_size; i++) {
         if (hist[i] > 0) {
-            symbols[n].sym = (unsigned char)i;
+            symbols[n].sym = i;
             symbols[n].count = hist[i];
             symbols[n].prob = 0.0;
             symbols[n].code[0] = '\0';
@@ -168,140 +582,160 @@ void count_symbols(const char *filename, SymbolEntry *symbols, int *num_symbols,
         symbols[i].self_info = -log2(symbols[i].prob);
     }
 
-    // 依 count 遞增排序，count 一樣時看 sym
-    for (int i = 0; i < n - 1; i++) {
-        for (int j = i + 1; j < n; j++) {
-            if (symbols[i].count > symbols[j].count ||
-               (symbols[i].count == symbols[j].count && symbols[i].sym > symbols[j].sym)) {
-                SymbolEntry tmp = symbols[i];
-                symbols[i] = symbols[j];
-                symbols[j] = tmp;
+    sort_symbols(symbols, n);
+
+    *total_symbols = total;
+    return n;
+}
+
+/* 兩個 queue 合併：葉節點已依 count 遞增排序，新產生的內部節點 count 也只會遞增，
+   所以每次最小的兩個一定在兩個 queue 的開頭，整個合併是 O(n)。
+   nodes[0..n-1] 為葉節點，需要 2n-1 個位置，回傳 root 的 index */
+static int merge_nodes(HuffmanNode *nodes, int n) {
+    int leaf = 0;        /* 下一個還沒用到的葉節點 */
+    int inner = n;       /* 下一個還沒用到的內部節點 */
+    int next = n;        /* 下一個內部節點要放的位置 */
+
+    while (next < 2 * n - 1) {
+        int pick[2];
+        for (int k = 0; k < 2; k++) {
+            // count 相同時先拿葉節點，樹會比較矮
+            if (inner >= next || (leaf < n && nodes[leaf].count <= nodes[inner].count)) {
+                pick[k] = leaf++;
+            } else {
+                pick[k] = inner++;
             }
         }
+        nodes[next].sym = -1;   // internal node
+        nodes[next].count = nodes[pick[0]].count + nodes[pick[1]].count;
+        nodes[next].left = pick[0];
+        nodes[next].right = pick[1];
+        next++;
     }
-
-    *num_symbols = n;
-    *total_symbols = total;
+    return next - 1;
 }
 
-HuffmanNode* build_huffman_tree(SymbolEntry *symbols, int num_symbols) {
-    if (num_symbols <= 0) return NULL;
+/* symbols 需依 count 遞增排序（histogram_to_symbols 的輸出），
+   nodes 要有 2 * num_symbols - 1 個位置；nodes[i] 就是 symbols[i] 的葉節點 */
+int build_huffman_tree(const SymbolEntry *symbols, int num_symbols, HuffmanNode *nodes) {
+    if (num_symbols <= 0) return -1;
 
-    int n = num_symbols;
-    HuffmanNode **nodes = (HuffmanNode **)malloc(sizeof(HuffmanNode*) * n);
-    if (!nodes) {
-        fprintf(stderr, "malloc failed\n");
-        exit(1);
+    for (int i = 0; i < num_symbols; i++) {
+        nodes[i].sym = symbols[i].sym;
+        nodes[i].count = symbols[i].count;
+        nodes[i].left = -1;
+        nodes[i].right = -1;
     }
+    return merge_nodes(nodes, num_symbols);
+}
 
-    for (int i = 0; i < n; i++) {
-        nodes[i] = (HuffmanNode *)malloc(sizeof(HuffmanNode));
-        if (!nodes[i]) {
-            fprintf(stderr, "malloc failed\n");
-            exit(1);
-        }
-        nodes[i]->sym = symbols[i].sym;
-        nodes[i]->count = symbols[i].count;
-        nodes[i]->left = NULL;
-        nodes[i]->right = NULL;
+/* 用固定大小的 stack 走訪，不遞迴也不配置記憶體；
+   葉節點的 index 就是 symbols[] 的 index，不用再搜尋 */
+void generate_code(const HuffmanNode *nodes, int root, SymbolEntry *symbols) {
+    /* 每一層最多只會留一個還沒走的右子樹，所以 stack 不會超過 code 長度上限 */
+    struct { int node; int depth; char bit; } stack[MAX_CODE_LEN + 1];
+    char code[MAX_CODE_LEN];
+    int top = 0;
+
+    if (root < 0) return;
+
+    // 若整棵樹只有一個符號，給它 code "0"
+    if (nodes[root].left < 0) {
+        strcpy(symbols[root].code, "0");
+        return;
     }
 
-    while (n > 1) {
-        int min1 = 0, min2 = 1;
-        if (nodes[min1]->count > nodes[min2]->count) {
-            int t = min1; min1 = min2; min2 = t;
-        }
-        for (int i = 2; i < n; i++) {
-            if (nodes[i]->count < nodes[min1]->count) {
-                min2 = min1;
-                min1 = i;
-            } else if (nodes[i]->count < nodes[min2]->count) {
-                min2 = i;
-            }
+    stack[top].node = root;
+    stack[top].depth = 0;
+    stack[top].bit = 0;
+    top++;
+
+    while (top > 0) {
+        top--;
+        int node = stack[top].node;
+        int depth = stack[top].depth;
+        if (depth > 0) code[depth - 1] = stack[top].bit;
+
+        if (nodes[node].left < 0) {
+            memcpy(symbols[node].code, code, (size_t)depth);
+            symbols[node].code[depth] = '\0';
+            continue;
         }
 
-        HuffmanNode *parent = (HuffmanNode *)malloc(sizeof(HuffmanNode));
-        if (!parent) {
-            fprintf(stderr, "malloc failed\n");
+        if (depth + 1 >= MAX_CODE_LEN) {
+            fprintf(stderr, "Huffman code longer than %d bits\n", MAX_CODE_LEN - 1);
             exit(1);
         }
-        parent->sym = 0; // internal node
-        parent->count = nodes[min1]->count + nodes[min2]->count;
-        parent->left = nodes[min1];
-        parent->right = nodes[min2];
-
-        if (min1 > min2) {
-            int t = min1; min1 = min2; min2 = t;
-        }
-        nodes[min1] = parent;
-        nodes[min2] = nodes[n - 1];
-        n--;
+        // 先放右邊再放左邊，左子樹先走完
+        stack[top].node = nodes[node].right;
+        stack[top].depth = depth + 1;
+        stack[top].bit = '1';
+        top++;
+        stack[top].node = nodes[node].left;
+        stack[top].depth = depth + 1;
+        stack[top].bit = '0';
+        top++;
     }
-
-    HuffmanNode *root = nodes[0];
-    free(nodes);
-    return root;
 }
 
-void generate_code(HuffmanNode *node, char *code, int depth, SymbolEntry *symbols, int num_symbols) {
-    if (!node) return;
-
-    // 葉節點
-    if (!node->left && !node->right) {
-        // 若整棵樹只有一個符號，depth 會是 0，給它 code "0"
-        if (depth == 0) {
-            code[0] = '0';
-            depth = 1;
-        }
-        code[depth] = '\0';
-
-        for (int i = 0; i < num_symbols; i++) {
-            if (symbols[i].sym == node->sym) {
-                strcpy(symbols[i].code, code);
-                break;
-            }
+/* token 若只含英文字母與空白就直接寫出來，否則寫成 0x 開頭的 hex 字串 */
+static void format_token(const Token *t, char *out) {
+    int printable = 1;
+    for (int i = 0; i < t->len; i++) {
+        unsigned char c = t->bytes[i];
+        if (!(c == ' ' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))) {
+            printable = 0;
+            break;
         }
+    }
+    if (printable && !(t->len == 3 && memcmp(t->bytes, "EOF", 3) == 0)) {
+        memcpy(out, t->bytes, (size_t)t->len);
+        out[t->len] = '\0';
         return;
     }
 
-    if (node->left) {
-        code[depth] = '0';
-        generate_code(node->left, code, depth + 1, symbols, num_symbols);
-    }
-    if (node->right) {
-        code[depth] = '1';
-        generate_code(node->right, code, depth + 1, symbols, num_symbols);
+    int k = sprintf(out, "0x");
+    for (int i = 0; i < t->len; i++) {
+        k += sprintf(out + k, "%02X", t->bytes[i]);
     }
 }
 
-void write_codebook(SymbolEntry *symbols, int num_symbols, const char *filename) {
+void write_codebook(SymbolEntry *symbols, int num_symbols, const TokenVocab *vocab,
+                    const char *header, const char *filename) {
     FILE *f = fopen(filename, "w");
     if (!f) {
         perror("fopen codebook");
         exit(1);
     }
 
+    // "# key=value ..." 開頭的列描述編碼格式，舊版 decoder 會直接略過
+    if (header) fprintf(f, "%s\n", header);
+
     for (int i = 0; i < num_symbols; i++) {
         const char *sym_str;
-        static char tmp[8];
+        static char tmp[2 * MAX_TOKEN_LEN + 3];
+        int sym = symbols[i].sym;
 
-        if (symbols[i].sym == '\n') {
+        if (sym >= FIRST_TOKEN_SYMBOL) {
+            format_token(&vocab->tokens[sym - FIRST_TOKEN_SYMBOL], tmp);
+            sym_str = tmp;
+        } else if (sym == EOF_SYMBOL) {
+            sym_str = "EOF";
+        } else if (sym == '\n') {
             sym_str = "\\n";
-        } else if (symbols[i].sym == '\r') {
+        } else if (sym == '\r') {
             sym_str = "\\r";
-        }else if (symbols[i].sym == 255) {
-            sym_str = "EOF";
-        } else if (symbols[i].sym < 32 || symbols[i].sym > 126 || symbols[i].sym == '\"') {
+        } else if (sym < 32 || sym > 126 || sym == '\"') {
             // 把 " 也用 0xXX 形式寫，避免破壞 CSV
-            sprintf(tmp, "0x%02X", symbols[i].sym);
-        sym_str = tmp;
+            sprintf(tmp, "0x%02X", sym);
+            sym_str = tmp;
         } else {
-            tmp[0] = (char)symbols[i].sym;
+            tmp[0] = (char)sym;
             tmp[1] = '\0';
             sym_str = tmp;
         }
 
-        fprintf(f, "\"%s\",%lu,%.15f,\"%s\",%.15f\n",
+        fprintf(f, "\"%s\",%llu,%.15f,\"%s\",%.15f\n",
                 sym_str,
                 symbols[i].count,
                 symbols[i].prob,
@@ -312,7 +746,84 @@ void write_codebook(SymbolEntry *symbols, int num_symbols, const char *filename)
     fclose(f);
 }
 
-void encode_file(const char *input_file, const char *output_file, SymbolEntry *symbols, int num_symbols) {
+/* 每個 symbol 的 code：32 bit 以內的 code 先轉成整數，寫的時候一次放進去 */
+typedef struct {
+    unsigned int bits;
+    int len;               /* 0 表示這個 symbol 沒有 code */
+    const char *code;      /* 超過 32 bit 的 code 才會用到 */
+} SymbolCode;
+
+typedef struct {
+    FILE *fout;
+    const SymbolCode *codes;   /* 直接用 symbol 當 index */
+    unsigned long long acc;    /* 還沒寫出去的 bit，靠右對齊，最多 31 個 */
+    int nbits;
+    unsigned char out[IO_BUF_SIZE];
+    size_t out_len;
+    unsigned long long num_symbols;
+    unsigned long long num_bits;   /* 不含最後補的 0 */
+    unsigned long long *emitted;   /* 每個 symbol 實際寫了幾次，NULL 表示不用數 */
+} BitWriter;
+
+static void put_bits(BitWriter *bw, unsigned int bits, int len) {
+    bw->acc = (bw->acc << len) | bits;
+    bw->nbits += len;
+    bw->num_bits += (unsigned long long)len;
+    if (bw->nbits >= 32) {
+        if (bw->out_len + 4 > sizeof(bw->out)) {
+            fwrite(bw->out, 1, bw->out_len, bw->fout);
+            bw->out_len = 0;
+        }
+        bw->nbits -= 32;
+        unsigned int word = (unsigned int)(bw->acc >> bw->nbits);
+        bw->out[bw->out_len++] = (unsigned char)(word >> 24);
+        bw->out[bw->out_len++] = (unsigned char)(word >> 16);
+        bw->out[bw->out_len++] = (unsigned char)(word >> 8);
+        bw->out[bw->out_len++] = (unsigned char)word;
+    }
+}
+
+/* 把剩下的 bit 補 0 湊成整數個 byte，全部寫出去 */
+static void flush_bits(BitWriter *bw) {
+    while (bw->nbits >= 8) {
+        bw->nbits -= 8;
+        bw->out[bw->out_len++] = (unsigned char)(bw->acc >> bw->nbits);
+    }
+    if (bw->nbits > 0) {
+        bw->out[bw->out_len++] = (unsigned char)(bw->acc << (8 - bw->nbits));
+        bw->nbits = 0;
+    }
+    fwrite(bw->out, 1, bw->out_len, bw->fout);
+    bw->out_len = 0;
+}
+
+static void put_code(BitWriter *bw, int sym) {
+    const SymbolCode *c = &bw->codes[sym];
+
+    if (c->len > 0 && c->len <= 32) {
+        put_bits(bw, c->bits, c->len);
+        return;
+    }
+    if (c->len == 0) {
+        fprintf(stderr, "No code found for symbol %d\n", sym);
+        exit(1);
+    }
+    for (int j = 0; c->code[j]; j++) {
+        put_bits(bw, c->code[j] == '1' ? 1u : 0u, 1);
+    }
+}
+
+static void write_symbol(int sym, void *ctx) {
+    BitWriter *bw = (BitWriter *)ctx;
+    put_code(bw, sym);
+    if (bw->emitted) bw->emitted[sym]++;
+    bw->num_symbols++;
+}
+
+void encode_file(const char *input_file, const char *output_file, const TokenVocab *vocab,
+                 SymbolEntry *symbols, int num_symbols,
+                 unsigned long long *total_bytes, unsigned long long *total_symbols,
+                 unsigned long long *encoded_bits, unsigned long long *emitted) {
     FILE *fin = fopen(input_file, "rb");
     FILE *fout = fopen(output_file, "wb");
     if (!fin || !fout) {
@@ -322,76 +833,179 @@ void encode_file(const char *input_file, const char *output_file, SymbolEntry *s
         exit(1);
     }
 
-    int c;
-    unsigned char buffer = 0;
-    int bits_filled = 0;
-
-    while ((c = fgetc(fin)) != EOF) {
-        unsigned char uc = (unsigned char)c;
-        const char *code = NULL;
-
-        for (int i = 0; i < num_symbols; i++) {
-            if (symbols[i].sym == uc) {
-                code = symbols[i].code;
-                break;
-            }
+    SymbolCode *codes = (SymbolCode *)calloc(MAX_ALPHABET, sizeof(SymbolCode));
+    BitWriter *bw = (BitWriter *)malloc(sizeof(BitWriter));
+    if (!codes || !bw) {
+        fprintf(stderr, "malloc failed\n");
+        exit(1);
+    }
+    for (int i = 0; i < num_symbols; i++) {
+        SymbolCode *c = &codes[symbols[i].sym];
+        c->code = symbols[i].code;
+        c->len = (int)strlen(symbols[i].code);
+        c->bits = 0;
+        for (int j = 0; j < c->len && c->len <= 32; j++) {
+            c->bits = (c->bits << 1) | (c->code[j] == '1' ? 1u : 0u);
         }
+    }
 
-        if (!code) {
-            fprintf(stderr, "No code found for symbol 0x%02X\n", uc);
-            fclose(fin);
-            fclose(fout);
+    bw->fout = fout;
+    bw->codes = codes;
+    bw->acc = 0;
+    bw->nbits = 0;
+    bw->out_len = 0;
+    bw->num_symbols = 0;
+    bw->num_bits = 0;
+    bw->emitted = emitted;
+
+    unsigned long long bytes = 0;
+    if (vocab && vocab->num_tokens > 0) {
+        PieceReader *r = (PieceReader *)malloc(sizeof(PieceReader));
+        if (!r) {
+            fprintf(stderr, "malloc failed\n");
             exit(1);
         }
-
-        for (int j = 0; code[j]; j++) {
-            buffer = (unsigned char)((buffer << 1) | (code[j] == '1' ? 1 : 0));
-            bits_filled++;
-            if (bits_filled == 8) {
-                fputc(buffer, fout);
-                buffer = 0;
-                bits_filled = 0;
+        TokenEncoder te;
+        const unsigned char *p;
+        int n;
+
+        piece_reader_init(r, fin);
+        token_encoder_init(&te, vocab, write_symbol, bw);
+        while ((n = piece_reader_next(r, &p)) > 0) {
+            token_encoder_piece(&te, p, n);
+            bytes += (unsigned long long)n;
+        }
+        token_encoder_flush(&te);
+        free(r);
+    } else {
+        unsigned char buf[IO_BUF_SIZE];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), fin)) > 0) {
+            for (size_t i = 0; i < n; i++) put_code(bw, buf[i]);
+            if (emitted) {
+                for (size_t i = 0; i < n; i++) emitted[buf[i]]++;
             }
+            bw->num_symbols += n;
+            bytes += n;
         }
     }
 
     // encode EOF
-    const char *eof_code = NULL;
-    for (int i = 0; i < num_symbols; i++) {
-        if (symbols[i].sym == 255) {
-            eof_code = symbols[i].code;
-            break;
-        }
-    }
-    if (!eof_code) {
+    if (codes[EOF_SYMBOL].len == 0) {
         fprintf(stderr, "EOF symbol code not found.\n");
         fclose(fin);
         fclose(fout);
         exit(1);
     }
+    write_symbol(EOF_SYMBOL, bw);
+    *total_bytes = bytes;
+    *total_symbols = bw->num_symbols;
+    *encoded_bits = bw->num_bits;
+    flush_bits(bw);
+
+    free(bw);
+    free(codes);
+    fclose(fin);
+    fclose(fout);
+}
 
-    for (int j = 0; eof_code[j]; j++) {
-        buffer = (unsigned char)((buffer << 1) | (eof_code[j] == '1' ? 1 : 0));
-        bits_filled++;
-        if (bits_filled == 8) {
-            fputc(buffer, fout);
-            buffer = 0;
-            bits_filled = 0;
-        }
+/* ----------------- 分塊編碼 ----------------- */
+
+/* 由 histogram 算每個 byte 的 Huffman code 長度（沒出現的為 0）。
+   每個 block 都會呼叫一次，所以全部在 stack 上完成：不配置記憶體、不算機率、不產生 code 字串 */
+void huffman_code_lengths(const unsigned long long *hist, unsigned char *lengths) {
+    HuffmanNode nodes[2 * BLOCK_NUM_SYMBOLS - 1];
+    unsigned char depth[2 * BLOCK_NUM_SYMBOLS - 1];
+    unsigned long long keys[BLOCK_NUM_SYMBOLS];
+    int n = 0;
+
+    memset(lengths, 0, BLOCK_NUM_SYMBOLS);
+    // block 不超過 BLOCK_MAX_SIZE，count 放得進 key 的高位
+    for (int s = 0; s < BLOCK_NUM_SYMBOLS; s++) {
+        if (hist[s] > 0) keys[n++] = (hist[s] << 8) | (unsigned long long)s;
+    }
+    if (n == 0) return;
+    if (n == 1) {
+        lengths[keys[0] & 0xFF] = 1;
+        return;
     }
 
-    if (bits_filled > 0) {
-        buffer <<= (8 - bits_filled);
-        fputc(buffer, fout);
+    sort_keys(keys, n);
+    for (int i = 0; i < n; i++) {
+        nodes[i].sym = (int)(keys[i] & 0xFF);
+        nodes[i].count = keys[i] >> 8;
+        nodes[i].left = -1;
+        nodes[i].right = -1;
     }
+    int root = merge_nodes(nodes, n);
 
-    fclose(fin);
-    fclose(fout);
+    /* 子節點的 index 一定比父節點小，從 root 往回掃就能一路算出深度 */
+    depth[root] = 0;
+    for (int i = root; i >= n; i--) {
+        depth[nodes[i].left] = (unsigned char)(depth[i] + 1);
+        depth[nodes[i].right] = (unsigned char)(depth[i] + 1);
+    }
+    for (int i = 0; i < n; i++) {
+        lengths[nodes[i].sym] = depth[i];
+    }
 }
 
-void free_huffman_tree(HuffmanNode *node) {
-    if (!node) return;
-    free_huffman_tree(node->left);
-    free_huffman_tree(node->right);
-    free(node);
+void encode_blocks(FILE *fin, const char *output_file, size_t block_size,
+                   unsigned long long *hist,
+                   unsigned long long *total_bytes, unsigned long long *encoded_bytes,
+                   unsigned long long *num_blocks) {
+    FILE *fout = fopen(output_file, "wb");
+    if (!fout) {
+        perror("fopen");
+        exit(1);
+    }
+    unsigned char *in = (unsigned char *)malloc(block_size);
+    unsigned char *out = (unsigned char *)malloc(block_max_encoded(block_size));
+    if (!in || !out) {
+        fprintf(stderr, "malloc failed\n");
+        exit(1);
+    }
+
+    unsigned char header[BLOCK_HEADER_SIZE];
+    fwrite(BLOCK_MAGIC, 1, 4, fout);
+    fputc(BLOCK_VERSION, fout);
+    *encoded_bytes = BLOCK_FILE_HEADER_SIZE;
+
+    for (;;) {
+        size_t n = 0, r;
+        while (n < block_size && (r = fread(in + n, 1, block_size - n, fin)) > 0) {
+            n += r;
+        }
+        if (n == 0) break;
+
+        unsigned long long block_hist[BLOCK_NUM_SYMBOLS] = {0};
+        unsigned char lengths[BLOCK_NUM_SYMBOLS];
+        for (size_t i = 0; i < n; i++) block_hist[in[i]]++;
+
+        huffman_code_lengths(block_hist, lengths);
+        limit_code_lengths(lengths, block_hist, BLOCK_MAX_CODE_LEN);
+
+        size_t data_len = block_encode(in, n, lengths, out);
+        block_write_header(header, (unsigned int)n, (unsigned int)data_len, lengths);
+        fwrite(header, 1, BLOCK_HEADER_SIZE, fout);
+        fwrite(out, 1, data_len, fout);
+
+        for (int s = 0; s < BLOCK_NUM_SYMBOLS; s++) hist[s] += block_hist[s];
+        *total_bytes += n;
+        *encoded_bytes += BLOCK_HEADER_SIZE + data_len;
+        (*num_blocks)++;
+    }
+
+    // 結束 block
+    unsigned char lengths[BLOCK_NUM_SYMBOLS] = {0};
+    block_write_header(header, 0, 0, lengths);
+    fwrite(header, 1, BLOCK_HEADER_SIZE, fout);
+    *encoded_bytes += BLOCK_HEADER_SIZE;
+
+    if (ferror(fout) || fclose(fout) != 0) {
+        perror("fwrite");
+        exit(1);
+    }
+    free(in);
+    free(out);
 }
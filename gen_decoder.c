@@ -0,0 +1,411 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "logger.h"
+#include "codebook.h"
+
+/* ----------------- 固定寬度的兩層查表 ----------------- */
+
+/* code 最長不超過 root_bits + DTABLE_SUB_BITS_MAX 時，查表最多兩層。
+   codebook_build_table 的子表寬度依各自的 code 而不同，這裡把每個子表都展開成
+   sub_bits 寬，產生的 decoder 就能用常數寬度查第二層，不用在執行時讀寬度。
+   子表的葉節點 len 是這一層用掉的 bit 數，展開後不變 */
+static void expand_sub_tables(const DecodeTable *t, int sub_bits, DecodeTable *out) {
+    size_t root_size = (size_t)1 << t->root_bits;
+    size_t sub_size = (size_t)1 << sub_bits;
+    size_t num_links = 0;
+
+    for (size_t k = 0; k < root_size; k++) {
+        if (t->data[k] & DTABLE_LINK_FLAG) num_links++;
+    }
+
+    out->size = root_size + num_links * sub_size;
+    out->cap = out->size;
+    out->root_bits = t->root_bits;
+    out->max_code_len = t->max_code_len;
+    out->data = (unsigned int *)malloc(sizeof(unsigned int) * out->size);
+    if (!out->data) {
+        fprintf(stderr, "malloc failed\n");
+        exit(1);
+    }
+
+    size_t next = root_size;
+    for (size_t k = 0; k < root_size; k++) {
+        unsigned int e = t->data[k];
+        if (!(e & DTABLE_LINK_FLAG)) {
+            out->data[k] = e;
+            continue;
+        }
+        size_t from = (e >> 8) & DTABLE_INDEX_MASK;
+        int w = (int)(e & 0xFFu);
+        for (size_t j = 0; j < sub_size; j++) {
+            out->data[next + j] = t->data[from + (j >> (sub_bits - w))];
+        }
+        out->data[k] = DTABLE_LINK_FLAG | ((unsigned int)next << 8) | (unsigned int)sub_bits;
+        next += sub_size;
+    }
+}
+
+/* 兩層的總大小是 2^root_bits + 子表數 * 2^(max_code_len - root_bits)，
+   在 code 最長不超過 root_bits + DTABLE_SUB_BITS_MAX 的範圍內挑最小的 root_bits；
+   code 太長、第一層超過 CODEBOOK_TABLE_BITS_MAX 也放不下時回傳 0 */
+static int pick_root_bits(const Codebook *cb, int max_code_len) {
+    int lo = max_code_len - DTABLE_SUB_BITS_MAX;
+    int hi = (max_code_len < CODEBOOK_TABLE_BITS_MAX) ? max_code_len : CODEBOOK_TABLE_BITS_MAX;
+    int best = 0;
+    size_t best_size = 0;
+
+    if (lo < 1) lo = 1;
+    for (int r = lo; r <= hi; r++) {
+        DecodeTable t;
+        if (codebook_build_table(cb, r, &t) != 0) break;
+
+        size_t num_links = 0;
+        for (size_t k = 0; k < ((size_t)1 << t.root_bits); k++) {
+            if (t.data[k] & DTABLE_LINK_FLAG) num_links++;
+        }
+        size_t size = ((size_t)1 << t.root_bits) + (num_links << (max_code_len - t.root_bits));
+        if (best == 0 || size < best_size) {
+            best = r;
+            best_size = size;
+        }
+        decode_table_free(&t);
+    }
+    return best;
+}
+
+/* ----------------- 輸出 C 原始碼 ----------------- */
+
+/* 快速路徑解一個 symbol：呼叫前 buf 至少有 P_MAX_CODE_LEN 個 bit，
+   out 至少還有 P_MAX_SYMBOL_LEN 個 byte，所以不用檢查長度 */
+static void write_fast_symbol(FILE *f, const char *p, const char *P, int sub_bits, int max_sym_len) {
+    fprintf(f, "        e = %s_table[buf >> (64 - %s_ROOT_BITS)];\n", p, P);
+    if (sub_bits > 0) {
+        fprintf(f, "        if (e & 0x%08Xu) {\n", DTABLE_LINK_FLAG);
+        fprintf(f, "            buf <<= %s_ROOT_BITS;\n", P);
+        fprintf(f, "            nbits -= %s_ROOT_BITS;\n", P);
+        fprintf(f, "            e = %s_table[((e >> 8) & 0x%06Xu) + (unsigned int)(buf >> (64 - %s_SUB_BITS))];\n",
+                p, DTABLE_INDEX_MASK, P);
+        fprintf(f, "        }\n");
+    }
+    fprintf(f, "        sym = (e >> 8) & 0x%06Xu;\n", DTABLE_INDEX_MASK);
+    fprintf(f, "        buf <<= (e & 0xFFu);\n");
+    fprintf(f, "        nbits -= (int)(e & 0xFFu);\n");
+    fprintf(f, "        if (sym == %s_EOF_SYMBOL) return (long)out_len;\n", P);
+    fprintf(f, "        if (sym == 0x%06Xu) return -1;\n", DTABLE_INVALID_SYMBOL);
+    if (max_sym_len == 1) {
+        fprintf(f, "        out[out_len++] = %s_sym_byte[sym];\n", p);
+    } else {
+        fprintf(f, "        memcpy(out + out_len, %s_sym_bytes + %s_sym_offset[sym], %s_MAX_SYMBOL_LEN);\n",
+                p, p, P);
+        fprintf(f, "        out_len += %s_sym_offset[sym + 1] - %s_sym_offset[sym];\n", p, p);
+    }
+}
+
+/* 一個 byte 一個 byte 補 bit，給輸入剩不到 8 byte 的尾巴和多層查表用 */
+static void write_byte_refill(FILE *f, const char *indent) {
+    fprintf(f, "%swhile (nbits <= 56 && in_pos < in_len) {\n", indent);
+    fprintf(f, "%s    buf |= (unsigned long long)in[in_pos++] << (56 - nbits);\n", indent);
+    fprintf(f, "%s    nbits += 8;\n", indent);
+    fprintf(f, "%s}\n", indent);
+}
+
+/* sub_bits：0 表示只有一層，>0 表示固定寬度的兩層，<0 表示 code 太長、用一般的多層迴圈 */
+static void write_decoder(FILE *f, const char *p, const char *cb_fn, const Codebook *cb,
+                          const DecodeTable *t, int sub_bits, int eof_index, int max_sym_len) {
+    char P[64];
+    int i;
+
+    for (i = 0; p[i] && i < (int)sizeof(P) - 1; i++) P[i] = (char)toupper((unsigned char)p[i]);
+    P[i] = '\0';
+
+    fprintf(f, "/* Generated by gen_decoder from %s. Do not edit.\n", cb_fn);
+    fprintf(f, " *\n");
+    fprintf(f, " *   long %s_decode(const unsigned char *in, size_t in_len, unsigned char *out, size_t out_cap);\n", p);
+    fprintf(f, " *\n");
+    fprintf(f, " * returns the number of bytes written to out, -1 on an invalid codeword or\n");
+    fprintf(f, " * a stream that ends before the EOF symbol, -2 if out_cap is too small.\n");
+    fprintf(f, " * Build with -D%s_MAIN for a standalone \"output.txt encoded.bin\" decoder. */\n\n", P);
+    fprintf(f, "#include <stddef.h>\n");
+    fprintf(f, "#include <string.h>\n\n");
+
+    fprintf(f, "#define %s_NUM_SYMBOLS    %d\n", P, cb->num_entries);
+    fprintf(f, "#define %s_MAX_CODE_LEN   %d\n", P, t->max_code_len);
+    fprintf(f, "#define %s_ROOT_BITS      %d\n", P, t->root_bits);
+    if (sub_bits > 0) fprintf(f, "#define %s_SUB_BITS       %d\n", P, sub_bits);
+    fprintf(f, "#define %s_TABLE_SIZE     %lu\n", P, (unsigned long)t->size);
+    fprintf(f, "#define %s_EOF_SYMBOL     %du\n", P, eof_index);
+    fprintf(f, "#define %s_MAX_SYMBOL_LEN %d\n", P, max_sym_len);
+    if (sub_bits >= 0) {
+        // 一次補到至少 56 個 bit，夠解這麼多個 symbol
+        fprintf(f, "#define %s_SYMS_PER_REFILL (56 / %s_MAX_CODE_LEN)\n", P, P);
+    }
+    fprintf(f, "\n");
+
+    fprintf(f, "static const unsigned int %s_table[%s_TABLE_SIZE] = {", p, P);
+    for (size_t k = 0; k < t->size; k++) {
+        fprintf(f, "%s0x%08Xu,", (k % 8 == 0) ? "\n    " : " ", t->data[k]);
+    }
+    fprintf(f, "\n};\n\n");
+
+    if (max_sym_len == 1) {
+        fprintf(f, "static const unsigned char %s_sym_byte[%s_NUM_SYMBOLS] = {", p, P);
+        for (i = 0; i < cb->num_entries; i++) {
+            fprintf(f, "%s0x%02X,", (i % 12 == 0) ? "\n    " : " ",
+                    cb->entries[i].len > 0 ? cb->entries[i].bytes[0] : 0);
+        }
+        fprintf(f, "\n};\n\n");
+    } else {
+        unsigned long total = 0;
+        fprintf(f, "static const unsigned int %s_sym_offset[%s_NUM_SYMBOLS + 1] = {", p, P);
+        for (i = 0; i < cb->num_entries; i++) {
+            fprintf(f, "%s%lu,", (i % 10 == 0) ? "\n    " : " ", total);
+            total += (unsigned long)cb->entries[i].len;
+        }
+        fprintf(f, " %lu\n};\n\n", total);
+
+        // 後面補 P_MAX_SYMBOL_LEN 個 0，每個 symbol 都能直接 memcpy 固定長度
+        fprintf(f, "static const unsigned char %s_sym_bytes[%lu + %s_MAX_SYMBOL_LEN] = {",
+                p, total, P);
+        unsigned long k = 0;
+        for (i = 0; i < cb->num_entries; i++) {
+            for (int j = 0; j < cb->entries[i].len; j++, k++) {
+                fprintf(f, "%s0x%02X,", (k % 12 == 0) ? "\n    " : " ", cb->entries[i].bytes[j]);
+            }
+        }
+        if (total == 0) fprintf(f, " 0");
+        fprintf(f, "\n};\n\n");
+    }
+
+    if (sub_bits >= 0) {
+        fprintf(f, "static unsigned long long %s_load64(const unsigned char *s) {\n", p);
+        fprintf(f, "    return ((unsigned long long)s[0] << 56) | ((unsigned long long)s[1] << 48) |\n");
+        fprintf(f, "           ((unsigned long long)s[2] << 40) | ((unsigned long long)s[3] << 32) |\n");
+        fprintf(f, "           ((unsigned long long)s[4] << 24) | ((unsigned long long)s[5] << 16) |\n");
+        fprintf(f, "           ((unsigned long long)s[6] << 8)  |  (unsigned long long)s[7];\n");
+        fprintf(f, "}\n\n");
+    }
+
+    fprintf(f, "long %s_decode(const unsigned char *in, size_t in_len,\n", p);
+    fprintf(f, "               unsigned char *out, size_t out_cap) {\n");
+    fprintf(f, "    unsigned long long buf = 0;\n");
+    fprintf(f, "    int nbits = 0, len;\n");
+    fprintf(f, "    size_t in_pos = 0, out_len = 0;\n");
+    fprintf(f, "    unsigned int e, sym;\n\n");
+
+    if (sub_bits >= 0) {
+        int per_refill = 56 / t->max_code_len;
+
+        /* 快速路徑：一次讀 8 byte 補到 56~63 個 bit，接著不檢查地解 P_SYMS_PER_REFILL 個 symbol。
+           buf 在 nbits 之後的 bit 不是 0 就是下一段資料本身，OR 進去不會出錯 */
+        fprintf(f, "    while (in_len - in_pos >= 8 &&\n");
+        fprintf(f, "           out_cap - out_len >= %s_SYMS_PER_REFILL * %s_MAX_SYMBOL_LEN) {\n", P, P);
+        fprintf(f, "        buf |= %s_load64(in + in_pos) >> nbits;\n", p);
+        fprintf(f, "        in_pos += (size_t)((63 - nbits) >> 3);\n");
+        fprintf(f, "        nbits |= 56;\n\n");
+        for (int k = 0; k < per_refill; k++) {
+            if (k > 0) fprintf(f, "\n");
+            write_fast_symbol(f, p, P, sub_bits, max_sym_len);
+        }
+        fprintf(f, "    }\n\n");
+
+        fprintf(f, "    for (;;) {\n");
+        write_byte_refill(f, "        ");
+        fprintf(f, "        if (nbits == 0) return -1;\n\n");
+        fprintf(f, "        e = %s_table[buf >> (64 - %s_ROOT_BITS)];\n", p, P);
+        if (sub_bits > 0) {
+            fprintf(f, "        if (e & 0x%08Xu) {\n", DTABLE_LINK_FLAG);
+            fprintf(f, "            if (%s_ROOT_BITS > nbits) return -1;\n", P);
+            fprintf(f, "            buf <<= %s_ROOT_BITS;\n", P);
+            fprintf(f, "            nbits -= %s_ROOT_BITS;\n", P);
+            fprintf(f, "            e = %s_table[((e >> 8) & 0x%06Xu) + (unsigned int)(buf >> (64 - %s_SUB_BITS))];\n",
+                    p, DTABLE_INDEX_MASK, P);
+            fprintf(f, "        }\n");
+        }
+    } else {
+        fprintf(f, "    for (;;) {\n");
+        write_byte_refill(f, "        ");
+        fprintf(f, "        if (nbits == 0) return -1;\n\n");
+        fprintf(f, "        int w = %s_ROOT_BITS;\n", P);
+        fprintf(f, "        e = %s_table[buf >> (64 - %s_ROOT_BITS)];\n", p, P);
+        fprintf(f, "        while (e & 0x%08Xu) {\n", DTABLE_LINK_FLAG);
+        fprintf(f, "            if (w > nbits) return -1;\n");
+        fprintf(f, "            buf <<= w;\n");
+        fprintf(f, "            nbits -= w;\n");
+        write_byte_refill(f, "            ");
+        fprintf(f, "            w = (int)(e & 0xFFu);\n");
+        fprintf(f, "            e = %s_table[((e >> 8) & 0x%06Xu) + (unsigned int)(buf >> (64 - w))];\n",
+                p, DTABLE_INDEX_MASK);
+        fprintf(f, "        }\n");
+    }
+    fprintf(f, "\n");
+    fprintf(f, "        len = (int)(e & 0xFFu);\n");
+    fprintf(f, "        sym = (e >> 8) & 0x%06Xu;\n", DTABLE_INDEX_MASK);
+    fprintf(f, "        if (len > nbits) return -1;\n");
+    fprintf(f, "        if (sym == 0x%06Xu) return -1;\n", DTABLE_INVALID_SYMBOL);
+    fprintf(f, "        buf <<= len;\n");
+    fprintf(f, "        nbits -= len;\n");
+    fprintf(f, "        if (sym == %s_EOF_SYMBOL) return (long)out_len;\n\n", P);
+    if (max_sym_len == 1) {
+        fprintf(f, "        if (out_len >= out_cap) return -2;\n");
+        fprintf(f, "        out[out_len++] = %s_sym_byte[sym];\n", p);
+    } else {
+        fprintf(f, "        unsigned int n = %s_sym_offset[sym + 1] - %s_sym_offset[sym];\n", p, p);
+        fprintf(f, "        if (out_len + n > out_cap) return -2;\n");
+        fprintf(f, "        memcpy(out + out_len, %s_sym_bytes + %s_sym_offset[sym], n);\n", p, p);
+        fprintf(f, "        out_len += n;\n");
+    }
+    fprintf(f, "    }\n");
+    fprintf(f, "}\n\n");
+    fprintf(f, "#ifdef %s_MAIN\n", P);
+    fprintf(f, "#include <stdio.h>\n");
+    fprintf(f, "#include <stdlib.h>\n\n");
+    fprintf(f, "int main(int argc, char **argv) {\n");
+    fprintf(f, "    if (argc != 3) {\n");
+    fprintf(f, "        fprintf(stderr, \"Usage: %%s output.txt encoded.bin\\n\", argv[0]);\n");
+    fprintf(f, "        return 1;\n");
+    fprintf(f, "    }\n\n");
+    fprintf(f, "    FILE *fin = fopen(argv[2], \"rb\");\n");
+    fprintf(f, "    if (!fin) {\n");
+    fprintf(f, "        perror(\"fopen\");\n");
+    fprintf(f, "        return 1;\n");
+    fprintf(f, "    }\n");
+    fprintf(f, "    fseek(fin, 0, SEEK_END);\n");
+    fprintf(f, "    long in_len = ftell(fin);\n");
+    fprintf(f, "    fseek(fin, 0, SEEK_SET);\n");
+    fprintf(f, "    unsigned char *in = (unsigned char *)malloc(in_len > 0 ? (size_t)in_len : 1);\n");
+    fprintf(f, "    if (!in || fread(in, 1, (size_t)in_len, fin) != (size_t)in_len) {\n");
+    fprintf(f, "        fprintf(stderr, \"read failed\\n\");\n");
+    fprintf(f, "        return 1;\n");
+    fprintf(f, "    }\n");
+    fprintf(f, "    fclose(fin);\n\n");
+    fprintf(f, "    size_t cap = (size_t)in_len * 4 + 64;\n");
+    fprintf(f, "    unsigned char *out = NULL;\n");
+    fprintf(f, "    long n;\n");
+    fprintf(f, "    do {\n");
+    fprintf(f, "        cap *= 2;\n");
+    fprintf(f, "        free(out);\n");
+    fprintf(f, "        out = (unsigned char *)malloc(cap);\n");
+    fprintf(f, "        if (!out) {\n");
+    fprintf(f, "            fprintf(stderr, \"malloc failed\\n\");\n");
+    fprintf(f, "            return 1;\n");
+    fprintf(f, "        }\n");
+    fprintf(f, "        n = %s_decode(in, (size_t)in_len, out, cap);\n", p);
+    fprintf(f, "    } while (n == -2);\n");
+    fprintf(f, "    if (n < 0) {\n");
+    fprintf(f, "        fprintf(stderr, \"invalid codeword or truncated stream\\n\");\n");
+    fprintf(f, "        return 1;\n");
+    fprintf(f, "    }\n\n");
+    fprintf(f, "    FILE *fout = fopen(argv[1], \"wb\");\n");
+    fprintf(f, "    if (!fout) {\n");
+    fprintf(f, "        perror(\"fopen\");\n");
+    fprintf(f, "        return 1;\n");
+    fprintf(f, "    }\n");
+    fprintf(f, "    fwrite(out, 1, (size_t)n, fout);\n");
+    fprintf(f, "    fclose(fout);\n");
+    fprintf(f, "    free(in);\n");
+    fprintf(f, "    free(out);\n");
+    fprintf(f, "    return 0;\n");
+    fprintf(f, "}\n");
+    fprintf(f, "#endif /* %s_MAIN */\n", P);
+}
+
+static int valid_prefix(const char *p) {
+    if (!p[0] || strlen(p) > 40 || !(isalpha((unsigned char)p[0]) || p[0] == '_')) return 0;
+    for (int i = 1; p[i]; i++) {
+        if (!(isalnum((unsigned char)p[i]) || p[i] == '_')) return 0;
+    }
+    return 1;
+}
+
+/* ----------------- main ----------------- */
+
+int main(int argc, char **argv) {
+    if (argc != 3 && argc != 4) {
+        fprintf(stderr, "Usage: %s codebook.csv decoder_out.c [prefix]\n", argv[0]);
+        return 1;
+    }
+
+    const char *cb_fn  = argv[1];
+    const char *out_fn = argv[2];
+    const char *prefix = (argc == 4) ? argv[3] : "huff";
+
+    if (!valid_prefix(prefix)) {
+        log_error("gen_decoder", "invalid_prefix prefix=%s", prefix);
+        return 1;
+    }
+
+    Codebook cb;
+    if (codebook_load(cb_fn, &cb) != 0) {
+        log_error("gen_decoder", "cannot_open_codebook codebook=%s", cb_fn);
+        return 1;
+    }
+    if (cb.block_format) {
+        // 分塊格式每個 block 的 code 都不同，沒有固定的 codebook 可以產生
+        log_error("gen_decoder", "block_format_codebook_not_supported codebook=%s", cb_fn);
+        codebook_free(&cb);
+        return 1;
+    }
+    if (cb.num_entries == 0) {
+        log_error("gen_decoder", "empty_codebook codebook=%s", cb_fn);
+        codebook_free(&cb);
+        return 1;
+    }
+
+    int max_sym_len = 1, eof_index = cb.num_entries;
+    for (int i = 0; i < cb.num_entries; i++) {
+        if (cb.entries[i].len > max_sym_len) max_sym_len = cb.entries[i].len;
+        if (cb.entries[i].sym == EOF_SYMBOL) eof_index = i;
+    }
+
+    DecodeTable t;
+    int rc = codebook_build_table(&cb, cb.table_bits > 0 ? cb.table_bits : DTABLE_ROOT_BITS_MAX, &t);
+    if (rc != 0) {
+        log_error("gen_decoder", "%s codebook=%s",
+                  (rc == -1) ? "invalid_code_char" : "codebook_not_prefix_free", cb_fn);
+        codebook_free(&cb);
+        return 1;
+    }
+
+    /* 依 code 長度決定產生哪一種查表：一層、固定寬度兩層，或一般的多層 */
+    int sub_bits = t.max_code_len - t.root_bits;
+    if (sub_bits > 0) {
+        int root_bits = pick_root_bits(&cb, t.max_code_len);
+        if (root_bits > 0) {
+            DecodeTable multi, fixed;
+            codebook_build_table(&cb, root_bits, &multi);
+            sub_bits = multi.max_code_len - multi.root_bits;
+            if (sub_bits > 0) {
+                expand_sub_tables(&multi, sub_bits, &fixed);
+                decode_table_free(&multi);
+            } else {
+                fixed = multi;
+            }
+            decode_table_free(&t);
+            t = fixed;
+        } else {
+            sub_bits = -1;
+        }
+    }
+
+    FILE *f = fopen(out_fn, "w");
+    if (!f) {
+        log_error("gen_decoder", "cannot_open_output_file output=%s", out_fn);
+        decode_table_free(&t);
+        codebook_free(&cb);
+        return 1;
+    }
+    write_decoder(f, prefix, cb_fn, &cb, &t, sub_bits, eof_index, max_sym_len);
+    fclose(f);
+
+    log_info("gen_decoder",
+             "done codebook=%s output_file=%s prefix=%s num_symbols=%d max_code_len=%d "
+             "root_bits=%d sub_bits=%d table_size=%lu",
+             cb_fn, out_fn, prefix, cb.num_entries, t.max_code_len,
+             t.root_bits, sub_bits, (unsigned long)t.size);
+
+    decode_table_free(&t);
+    codebook_free(&cb);
+    return 0;
+}
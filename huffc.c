@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "huffd.h"
+
+/* huffd 的簡單 client：
+   huffc socket_path encode|decode codebook_index input output [-n repeat]
+   huffc socket_path stats */
+
+static int write_all(int fd, const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char *)data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int read_all(int fd, void *data, size_t len) {
+    unsigned char *p = (unsigned char *)data;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static unsigned char *read_file(const char *filename, size_t *len) {
+    FILE *f = fopen(filename, "rb");
+    if (!f) {
+        perror("fopen");
+        exit(1);
+    }
+    size_t cap = 65536, n = 0;
+    unsigned char *data = (unsigned char *)malloc(cap);
+    size_t r;
+    while (data && (r = fread(data + n, 1, cap - n, f)) > 0) {
+        n += r;
+        if (n == cap) {
+            cap *= 2;
+            data = (unsigned char *)realloc(data, cap);
+        }
+    }
+    if (!data) {
+        fprintf(stderr, "malloc failed\n");
+        exit(1);
+    }
+    fclose(f);
+    *len = n;
+    return data;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s socket_path encode|decode codebook_index input output [-n repeat]\n", prog);
+    fprintf(stderr, "       %s socket_path stats\n", prog);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    HuffdRequest req;
+    memset(&req, 0, sizeof(req));
+    req.magic = HUFFD_MAGIC;
+
+    const char *in_fn = NULL, *out_fn = NULL;
+    int repeat = 1;
+
+    if (strcmp(argv[2], "stats") == 0 && argc == 3) {
+        req.op = HUFFD_OP_STATS;
+    } else if ((strcmp(argv[2], "encode") == 0 || strcmp(argv[2], "decode") == 0) &&
+               (argc == 6 || (argc == 8 && strcmp(argv[6], "-n") == 0))) {
+        req.op = (argv[2][0] == 'e') ? HUFFD_OP_ENCODE : HUFFD_OP_DECODE;
+        req.codebook = (unsigned char)atoi(argv[3]);
+        in_fn = argv[4];
+        out_fn = argv[5];
+        if (argc == 8) repeat = atoi(argv[7]);
+        if (repeat < 1) repeat = 1;
+    } else {
+        usage(argv[0]);
+        return 1;
+    }
+
+    size_t in_len = 0;
+    unsigned char *payload = in_fn ? read_file(in_fn, &in_len) : NULL;
+    if (in_len > HUFFD_MAX_PAYLOAD) {
+        fprintf(stderr, "input too large (max %u bytes)\n", HUFFD_MAX_PAYLOAD);
+        return 1;
+    }
+    req.payload_len = (unsigned int)in_len;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, argv[1], sizeof(addr.sun_path) - 1);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        perror("connect");
+        return 1;
+    }
+
+    HuffdResponse resp;
+    unsigned char *reply = NULL;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    for (int i = 0; i < repeat; i++) {
+        if (write_all(fd, &req, sizeof(req)) != 0 ||
+            (in_len > 0 && write_all(fd, payload, in_len) != 0) ||
+            read_all(fd, &resp, sizeof(resp)) != 0) {
+            fprintf(stderr, "connection closed by server\n");
+            return 1;
+        }
+        free(reply);
+        reply = (unsigned char *)malloc(resp.payload_len + 1);
+        if (!reply || read_all(fd, reply, resp.payload_len) != 0) {
+            fprintf(stderr, "connection closed by server\n");
+            return 1;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    close(fd);
+
+    if (resp.status != HUFFD_OK) {
+        fprintf(stderr, "request failed status=%u\n", resp.status);
+        return 1;
+    }
+
+    if (req.op == HUFFD_OP_STATS) {
+        fwrite(reply, 1, resp.payload_len, stdout);
+        fputc('\n', stdout);
+    } else {
+        FILE *fout = fopen(out_fn, "wb");
+        if (!fout) {
+            perror("fopen");
+            return 1;
+        }
+        fwrite(reply, 1, resp.payload_len, fout);
+        fclose(fout);
+
+        double us = ((double)(t1.tv_sec - t0.tv_sec) * 1e6 + (double)(t1.tv_nsec - t0.tv_nsec) / 1e3) / repeat;
+        printf("requests=%d bytes_in=%lu bytes_out=%u avg_latency_us=%.1f\n",
+               repeat, (unsigned long)in_len, resp.payload_len, us);
+    }
+
+    free(reply);
+    free(payload);
+    return 0;
+}
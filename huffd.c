@@ -0,0 +1,712 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "logger.h"
+#include "coder.h"
+#include "huffd.h"
+
+#define MAX_CODEBOOKS   16
+#define MAX_WORKERS     64
+#define DEFAULT_WORKERS 4
+#define MAX_CONNS       1024
+/* accept 因為 fd 用完失敗時，暫停接新連線多久（毫秒） */
+#define ACCEPT_BACKOFF_MS 100
+/* epoll 事件的 data：0 .. MAX_CONNS-1 是 conns[] 的 index */
+#define EVENT_LISTEN    MAX_CONNS
+#define EVENT_WAKE      (MAX_CONNS + 1)
+
+/* 閒置 buffer 最多留幾個：大約是每個 worker 一組 batch 的 in/out 加上連線的 in */
+#define BUFFERS_PER_WORKER 3
+
+/* latency 直方圖：第 i 格是 < 2^i 微秒，最後一格是更久的 */
+#define LATENCY_BUCKETS 24
+
+typedef struct {
+    pthread_mutex_t lock;
+    unsigned long long requests;
+    unsigned long long encode_requests;
+    unsigned long long decode_requests;
+    unsigned long long stats_requests;
+    unsigned long long errors;
+    unsigned long long batches;
+    unsigned long long connections;
+    unsigned long long bytes_in;
+    unsigned long long bytes_out;
+    unsigned long long latency[LATENCY_BUCKETS];
+} Stats;
+
+/* 一條連線上已收齊的 request，整批交給 worker，回覆放在 out */
+typedef struct {
+    ByteBuf in;            /* 完整的 request（header + payload）接在一起 */
+    ByteBuf out;
+    int bad;               /* in 後面接著一個格式錯誤的 request：回錯誤後關閉連線 */
+} Batch;
+
+/* 連線平常歸主 thread（epoll），切出一個 batch 之後到 worker 處理完之前歸 worker；
+   每條連線同時最多一個 batch，回覆順序不會亂。
+   fd 用 EPOLLONESHOT 登記，誰拿到連線誰負責重新登記 */
+typedef struct {
+    int fd;                /* -1 表示空位 */
+    ByteBuf in;            /* 收到但還沒分批的 bytes */
+    Batch batch;
+    int writing;           /* batch.out 還沒寫完，等 EPOLLOUT */
+    size_t out_pos;
+    int closing;           /* 對方關閉、讀寫錯誤或協定錯誤：手上的 batch 處理完就關 */
+} Conn;
+
+/* batch 佇列（主 thread -> worker）與完成佇列（worker -> 主 thread），放的是 conns[] 的 index。
+   每條連線最多一個 batch，所以 MAX_CONNS 格一定放得下 */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    int items[MAX_CONNS];
+    int head;
+    int count;
+} ConnIndexQueue;
+
+/* 用完的 buffer 放回這裡，下一條連線或下一批直接拿來用，不必每個 request 重新 malloc */
+typedef struct {
+    pthread_mutex_t lock;
+    ByteBuf bufs[MAX_WORKERS * BUFFERS_PER_WORKER];
+    int count;
+    int max_count;
+} BufferPool;
+
+static Coder coders[MAX_CODEBOOKS];
+static int num_coders = 0;
+static Stats stats;
+static Conn conns[MAX_CONNS];
+static ConnIndexQueue work_queue;
+static ConnIndexQueue done_queue;
+static BufferPool buffer_pool;
+static int num_conns = 0;
+static int epfd = -1;
+static int wake_fds[2] = { -1, -1 };   /* 連線交回主 thread 時寫一個 byte，叫醒 epoll_wait */
+static struct timespec start_time;
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_signal(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+static double elapsed_us(const struct timespec *from, const struct timespec *to) {
+    return (double)(to->tv_sec - from->tv_sec) * 1e6 + (double)(to->tv_nsec - from->tv_nsec) / 1e3;
+}
+
+/* ----------------- 佇列 ----------------- */
+
+static void queue_push(ConnIndexQueue *q, int idx) {
+    pthread_mutex_lock(&q->lock);
+    q->items[(q->head + q->count) % MAX_CONNS] = idx;
+    q->count++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static int queue_pop(ConnIndexQueue *q) {
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0) pthread_cond_wait(&q->not_empty, &q->lock);
+    int idx = q->items[q->head];
+    q->head = (q->head + 1) % MAX_CONNS;
+    q->count--;
+    pthread_mutex_unlock(&q->lock);
+    return idx;
+}
+
+/* 不等待，空的時候回傳 -1 */
+static int queue_try_pop(ConnIndexQueue *q) {
+    int idx = -1;
+    pthread_mutex_lock(&q->lock);
+    if (q->count > 0) {
+        idx = q->items[q->head];
+        q->head = (q->head + 1) % MAX_CONNS;
+        q->count--;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return idx;
+}
+
+static void queue_init(ConnIndexQueue *q) {
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    q->head = 0;
+    q->count = 0;
+}
+
+/* ----------------- buffer pool ----------------- */
+
+/* 給 b 一個閒置的 buffer（b 必須是空的），pool 空了就留著讓 bytebuf_reserve 配置 */
+static void buffer_get(ByteBuf *b) {
+    pthread_mutex_lock(&buffer_pool.lock);
+    if (buffer_pool.count > 0) {
+        *b = buffer_pool.bufs[--buffer_pool.count];
+        b->len = 0;
+    }
+    pthread_mutex_unlock(&buffer_pool.lock);
+}
+
+/* 把 b 的 buffer 還給 pool（pool 滿了就釋放），b 變回空的 */
+static void buffer_put(ByteBuf *b) {
+    if (b->cap == 0) return;
+    pthread_mutex_lock(&buffer_pool.lock);
+    if (buffer_pool.count < buffer_pool.max_count) {
+        buffer_pool.bufs[buffer_pool.count++] = *b;
+        b->data = NULL;
+        b->len = 0;
+        b->cap = 0;
+    }
+    pthread_mutex_unlock(&buffer_pool.lock);
+    bytebuf_free(b);
+}
+
+static void batch_release(Batch *batch) {
+    buffer_put(&batch->in);
+    buffer_put(&batch->out);
+}
+
+/* ----------------- 統計 ----------------- */
+
+static void stats_record(int op, int status, size_t bytes_in, size_t bytes_out, double latency_us) {
+    int bucket = 0;
+    while (bucket < LATENCY_BUCKETS - 1 && latency_us >= (double)(1ULL << bucket)) bucket++;
+
+    pthread_mutex_lock(&stats.lock);
+    stats.requests++;
+    if (op == HUFFD_OP_ENCODE) stats.encode_requests++;
+    else if (op == HUFFD_OP_DECODE) stats.decode_requests++;
+    else if (op == HUFFD_OP_STATS) stats.stats_requests++;
+    if (status != HUFFD_OK) stats.errors++;
+    stats.bytes_in += bytes_in;
+    stats.bytes_out += bytes_out;
+    stats.latency[bucket]++;
+    pthread_mutex_unlock(&stats.lock);
+}
+
+static void stats_format(ByteBuf *out) {
+    char text[2048];
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    pthread_mutex_lock(&stats.lock);
+    int k = snprintf(text, sizeof(text),
+                     "uptime_s=%.3f codebooks=%d requests=%llu encode_requests=%llu "
+                     "decode_requests=%llu stats_requests=%llu errors=%llu connections=%llu "
+                     "batches=%llu bytes_in=%llu bytes_out=%llu latency_us_hist=",
+                     elapsed_us(&start_time, &now) / 1e6, num_coders,
+                     stats.requests, stats.encode_requests, stats.decode_requests,
+                     stats.stats_requests, stats.errors, stats.connections,
+                     stats.batches, stats.bytes_in, stats.bytes_out);
+    for (int i = 0; i < LATENCY_BUCKETS && k < (int)sizeof(text); i++) {
+        if (i < LATENCY_BUCKETS - 1) {
+            k += snprintf(text + k, sizeof(text) - (size_t)k, "%slt%llu:%llu",
+                          i ? "," : "", 1ULL << i, stats.latency[i]);
+        } else {
+            k += snprintf(text + k, sizeof(text) - (size_t)k, ",inf:%llu", stats.latency[i]);
+        }
+    }
+    pthread_mutex_unlock(&stats.lock);
+
+    if (k >= (int)sizeof(text)) k = (int)sizeof(text) - 1;
+    bytebuf_reserve(out, (size_t)k);
+    memcpy(out->data + out->len, text, (size_t)k);
+    out->len += (size_t)k;
+}
+
+/* ----------------- request 處理 ----------------- */
+
+/* 處理一個 request，把 response 接在 out 後面 */
+static void handle_request(const HuffdRequest *req, const unsigned char *payload, ByteBuf *out) {
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    size_t header_pos = out->len;
+    bytebuf_reserve(out, sizeof(HuffdResponse));
+    out->len += sizeof(HuffdResponse);
+
+    unsigned int status = HUFFD_OK;
+    if (req->op == HUFFD_OP_STATS) {
+        stats_format(out);
+    } else if (req->op != HUFFD_OP_ENCODE && req->op != HUFFD_OP_DECODE) {
+        status = HUFFD_ERR_BAD_REQUEST;
+    } else if (req->codebook >= num_coders) {
+        status = HUFFD_ERR_NO_CODEBOOK;
+    } else if (req->op == HUFFD_OP_ENCODE) {
+        if (coder_encode(&coders[req->codebook], payload, req->payload_len, out) != 0) {
+            status = HUFFD_ERR_ENCODE;
+        }
+    } else {
+        int rc = coder_decode(&coders[req->codebook], payload, req->payload_len, HUFFD_MAX_PAYLOAD, out);
+        if (rc == -2) {
+            status = HUFFD_ERR_TOO_LARGE;
+        } else if (rc != 0) {
+            status = HUFFD_ERR_DECODE;
+        }
+    }
+
+    size_t payload_out = out->len - header_pos - sizeof(HuffdResponse);
+    if (status == HUFFD_OK && payload_out > HUFFD_MAX_PAYLOAD) status = HUFFD_ERR_TOO_LARGE;
+    if (status != HUFFD_OK) {
+        out->len = header_pos + sizeof(HuffdResponse);
+        payload_out = 0;
+    }
+
+    HuffdResponse resp;
+    resp.status = status;
+    resp.payload_len = (unsigned int)payload_out;
+    memcpy(out->data + header_pos, &resp, sizeof(resp));
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    stats_record(req->op, (int)status, req->payload_len, payload_out, elapsed_us(&t0, &t1));
+}
+
+/* worker：依序處理一批 request，回覆累積在 batch->out */
+static void process_batch(Batch *batch) {
+    size_t pos = 0;
+    int num_requests = 0;
+
+    batch->out.len = 0;
+    while (pos < batch->in.len) {
+        HuffdRequest req;
+        memcpy(&req, batch->in.data + pos, sizeof(req));
+        handle_request(&req, batch->in.data + pos + sizeof(req), &batch->out);
+        pos += sizeof(req) + req.payload_len;
+        num_requests++;
+    }
+
+    if (batch->bad) {
+        // 協定錯誤無法再對齊後面的資料，回一個錯誤後關閉連線
+        HuffdResponse resp = { HUFFD_ERR_BAD_REQUEST, 0 };
+        bytebuf_reserve(&batch->out, sizeof(resp));
+        memcpy(batch->out.data + batch->out.len, &resp, sizeof(resp));
+        batch->out.len += sizeof(resp);
+        stats_record(0, HUFFD_ERR_BAD_REQUEST, 0, 0, 0.0);
+    }
+
+    if (num_requests > 0) {
+        pthread_mutex_lock(&stats.lock);
+        stats.batches++;
+        pthread_mutex_unlock(&stats.lock);
+    }
+}
+
+static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return (flags < 0) ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static long long now_ms(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long)t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+/* in 開頭有幾個 bytes 是完整的 request；碰到格式錯誤的 header 時 *bad 設為 1，
+   *need 是下一個還沒收完的 request 總共要多少 bytes（還不知道時為 0） */
+static size_t complete_requests(const ByteBuf *in, int *bad, size_t *need) {
+    size_t pos = 0;
+    *bad = 0;
+    *need = 0;
+    while (in->len - pos >= sizeof(HuffdRequest)) {
+        HuffdRequest req;
+        memcpy(&req, in->data + pos, sizeof(req));
+        if (req.magic != HUFFD_MAGIC || req.payload_len > HUFFD_MAX_PAYLOAD) {
+            *bad = 1;
+            break;
+        }
+        if (in->len - pos - sizeof(req) < req.payload_len) {
+            *need = pos + sizeof(req) + req.payload_len;
+            break;
+        }
+        pos += sizeof(req) + req.payload_len;
+    }
+    return pos;
+}
+
+static void conn_watch(Conn *c, unsigned int events) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events | EPOLLONESHOT;
+    ev.data.u32 = (unsigned int)(c - conns);
+    epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+static void wake_main(void) {
+    char b = 0;
+    while (write(wake_fds[1], &b, 1) < 0 && errno == EINTR) {
+    }
+}
+
+/* batch 在 worker 手上時連線歸 worker，直接試著把回覆寫出去，少一次 thread 切換 */
+static void write_reply(Conn *c) {
+    c->out_pos = 0;
+    while (c->out_pos < c->batch.out.len) {
+        ssize_t n = write(c->fd, c->batch.out.data + c->out_pos, c->batch.out.len - c->out_pos);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        c->out_pos += (size_t)n;
+    }
+}
+
+static void *worker_main(void *arg) {
+    (void)arg;
+    for (;;) {
+        int idx = queue_pop(&work_queue);
+        Conn *c = &conns[idx];
+        process_batch(&c->batch);
+        write_reply(c);
+
+        int bad;
+        size_t need;
+        if (c->out_pos == c->batch.out.len && !c->closing &&
+            complete_requests(&c->in, &bad, &need) == 0 && !bad) {
+            // 常見情況：回覆寫完、沒有排隊的 request，連線直接回到 epoll，不用叫醒主 thread
+            batch_release(&c->batch);
+            conn_watch(c, EPOLLIN);
+        } else {
+            queue_push(&done_queue, idx);
+            wake_main();
+        }
+    }
+    return NULL;
+}
+
+/* ----------------- 連線（主 thread） ----------------- */
+
+static void conn_close(Conn *c) {
+    close(c->fd);
+    c->fd = -1;
+    buffer_put(&c->in);
+    batch_release(&c->batch);
+    num_conns--;
+}
+
+/* 把 in 裡所有完整的 request 切成一批交給 worker，有交出去回傳 1。
+   交出去之後連線歸 worker，呼叫端不能再碰 c */
+static int conn_dispatch(Conn *c) {
+    int bad;
+    size_t need;
+    size_t pos = complete_requests(&c->in, &bad, &need);
+    if (pos == 0 && !bad) {
+        // payload 還沒收完，先確定 buffer 放得下
+        if (need > c->in.len) bytebuf_reserve(&c->in, need - c->in.len);
+        return 0;
+    }
+
+    if (bad || pos == c->in.len) {
+        // 通常 in 整個都是完整的 request：直接把 buffer 交給 batch，不用複製
+        c->batch.in = c->in;
+        c->batch.in.len = pos;
+        memset(&c->in, 0, sizeof(c->in));
+    } else {
+        // 後面還接著收到一半的 request：只把完整的部分複製出去
+        buffer_get(&c->batch.in);
+        bytebuf_reserve(&c->batch.in, pos);
+        memcpy(c->batch.in.data, c->in.data, pos);
+        c->batch.in.len = pos;
+        memmove(c->in.data, c->in.data + pos, c->in.len - pos);
+        c->in.len -= pos;
+    }
+    buffer_get(&c->batch.out);
+    c->batch.bad = bad;
+    if (bad) c->closing = 1;
+
+    queue_push(&work_queue, (int)(c - conns));
+    return 1;
+}
+
+/* 寫完 worker 沒寫完的回覆，socket 暫時寫不下就保持 writing */
+static void conn_flush(Conn *c) {
+    while (c->out_pos < c->batch.out.len) {
+        ssize_t n = write(c->fd, c->batch.out.data + c->out_pos, c->batch.out.len - c->out_pos);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            c->closing = 1;
+            c->in.len = 0;
+            break;
+        }
+        c->out_pos += (size_t)n;
+    }
+    c->writing = 0;
+}
+
+static void conn_read(Conn *c) {
+    if (c->in.cap == 0) buffer_get(&c->in);
+    for (;;) {
+        bytebuf_reserve(&c->in, 65536);
+        ssize_t n = read(c->fd, c->in.data + c->in.len, c->in.cap - c->in.len);
+        if (n > 0) {
+            c->in.len += (size_t)n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        c->closing = 1;   // 對方關閉或讀取錯誤；已收齊的 request 還是會處理
+        break;
+    }
+}
+
+/* 讀寫之後決定連線的下一步：繼續寫、交給 worker、關閉，或等下一個 request */
+static void conn_next(Conn *c) {
+    if (c->writing) {
+        conn_watch(c, EPOLLOUT);
+        return;
+    }
+    batch_release(&c->batch);
+    if (conn_dispatch(c)) return;
+    if (c->closing) {
+        conn_close(c);
+        return;
+    }
+    conn_watch(c, EPOLLIN);
+}
+
+static void accept_connections(int lfd, long long *paused_until) {
+    while (num_conns < MAX_CONNS) {
+        int fd = accept(lfd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                // fd 或記憶體用完：一直重試只會空轉，先暫停接新連線
+                log_warn("huffd", "accept_backoff errno=%d backoff_ms=%d", errno, ACCEPT_BACKOFF_MS);
+                epoll_ctl(epfd, EPOLL_CTL_DEL, lfd, NULL);
+                *paused_until = now_ms() + ACCEPT_BACKOFF_MS;
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNABORTED) {
+                log_error("huffd", "accept_failed errno=%d", errno);
+            }
+            return;
+        }
+
+        int slot = 0;
+        while (conns[slot].fd >= 0) slot++;
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLONESHOT;
+        ev.data.u32 = (unsigned int)slot;
+        if (set_nonblocking(fd) != 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            log_error("huffd", "cannot_watch_connection errno=%d", errno);
+            close(fd);
+            continue;
+        }
+        memset(&conns[slot], 0, sizeof(Conn));
+        conns[slot].fd = fd;
+        num_conns++;
+
+        pthread_mutex_lock(&stats.lock);
+        stats.connections++;
+        pthread_mutex_unlock(&stats.lock);
+    }
+    // 連線數滿了：先不接，等有連線關掉
+    epoll_ctl(epfd, EPOLL_CTL_DEL, lfd, NULL);
+    *paused_until = now_ms() + ACCEPT_BACKOFF_MS;
+}
+
+/* ----------------- main ----------------- */
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-w workers] socket_path codebook.csv [codebook.csv ...]\n", prog);
+}
+
+int main(int argc, char **argv) {
+    int num_workers = DEFAULT_WORKERS;
+    int argi = 1;
+
+    while (argi < argc && argv[argi][0] == '-' && argv[argi][1] != '\0') {
+        if (strcmp(argv[argi], "-w") == 0 && argi + 1 < argc) {
+            num_workers = atoi(argv[argi + 1]);
+            if (num_workers < 1) num_workers = 1;
+            if (num_workers > MAX_WORKERS) num_workers = MAX_WORKERS;
+            argi += 2;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - argi < 2 || argc - argi - 1 > MAX_CODEBOOKS) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const char *sock_path = argv[argi];
+
+    /* 初始化 logger，輸出到 huffd.log */
+    log_init(NULL, NULL);
+    FILE *logf = fopen("huffd.log", "w");
+    if (logf) {
+        log_set_info_fp(logf);
+        log_set_error_fp(logf);
+    } else {
+        log_error("huffd", "cannot_open_log_file huffd.log, fallback to stdout/stderr");
+    }
+
+    log_info("huffd", "start socket=%s workers=%d", sock_path, num_workers);
+
+    /* codebook 只在啟動時讀一次，之後常駐 */
+    for (int i = argi + 1; i < argc; i++) {
+        int rc = coder_load(&coders[num_coders], argv[i]);
+        if (rc != 0) {
+            log_error("huffd", "%s codebook=%s",
+                      (rc == -1) ? "cannot_open_codebook" : "invalid_codebook", argv[i]);
+            log_error("huffd", "finish status=error");
+            if (logf) fclose(logf);
+            return 1;
+        }
+        log_info("huffd", "load_codebook index=%d codebook=%s entries=%d num_tokens=%d table_size=%lu",
+                 num_coders, argv[i], coders[num_coders].cb.num_entries,
+                 coders[num_coders].vocab.num_tokens, (unsigned long)coders[num_coders].dtable.size);
+        num_coders++;
+    }
+
+    int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (lfd < 0 || strlen(sock_path) >= sizeof(addr.sun_path)) {
+        log_error("huffd", "cannot_create_socket socket=%s", sock_path);
+        log_error("huffd", "finish status=error");
+        if (logf) fclose(logf);
+        return 1;
+    }
+    strcpy(addr.sun_path, sock_path);
+    unlink(sock_path);
+    if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(lfd, 128) != 0) {
+        log_error("huffd", "cannot_listen socket=%s errno=%d", sock_path, errno);
+        log_error("huffd", "finish status=error");
+        close(lfd);
+        if (logf) fclose(logf);
+        return 1;
+    }
+
+    /* 不用 SA_RESTART，讓 epoll_wait 在收到訊號時返回 */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    pthread_mutex_init(&stats.lock, NULL);
+    queue_init(&work_queue);
+    queue_init(&done_queue);
+    pthread_mutex_init(&buffer_pool.lock, NULL);
+    buffer_pool.max_count = num_workers * BUFFERS_PER_WORKER;
+    for (int i = 0; i < MAX_CONNS; i++) conns[i].fd = -1;
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    epfd = epoll_create1(0);
+    int ok = epfd >= 0 && pipe(wake_fds) == 0 && set_nonblocking(wake_fds[0]) == 0 && set_nonblocking(lfd) == 0;
+    ev.events = EPOLLIN;
+    ev.data.u32 = EVENT_WAKE;
+    ok = ok && epoll_ctl(epfd, EPOLL_CTL_ADD, wake_fds[0], &ev) == 0;
+    ev.data.u32 = EVENT_LISTEN;
+    ok = ok && epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &ev) == 0;
+    if (!ok) {
+        log_error("huffd", "cannot_create_epoll errno=%d", errno);
+        log_error("huffd", "finish status=error");
+        close(lfd);
+        if (logf) fclose(logf);
+        return 1;
+    }
+
+    /* worker 建立前先擋住 SIGINT/SIGTERM，worker 會繼承，訊號就一定送到主 thread 的 epoll_wait */
+    sigset_t stop_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, NULL);
+
+    for (int i = 0; i < num_workers; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, worker_main, NULL) != 0) {
+            log_error("huffd", "cannot_start_worker index=%d", i);
+            log_error("huffd", "finish status=error");
+            if (logf) fclose(logf);
+            return 1;
+        }
+        pthread_detach(tid);
+    }
+    pthread_sigmask(SIG_UNBLOCK, &stop_signals, NULL);
+
+    log_info("huffd", "listening socket=%s", sock_path);
+
+    /* 主 thread 用 epoll 管所有連線：讀 request、切成 batch 交給 worker。
+       worker 只拿到已收齊的 batch，閒置或很慢的 client 不會佔住 worker */
+    struct epoll_event events[64];
+    long long accept_paused_until = 0;
+
+    while (!stop_requested) {
+        int timeout = -1;
+        if (accept_paused_until > 0) {
+            long long wait = accept_paused_until - now_ms();
+            if (wait <= 0 && num_conns < MAX_CONNS) {
+                ev.events = EPOLLIN;
+                ev.data.u32 = EVENT_LISTEN;
+                epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &ev);
+                accept_paused_until = 0;
+            } else {
+                timeout = (wait > 0) ? (int)wait : ACCEPT_BACKOFF_MS;
+            }
+        }
+
+        int n = epoll_wait(epfd, events, 64, timeout);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            log_error("huffd", "epoll_wait_failed errno=%d", errno);
+            break;
+        }
+
+        for (int k = 0; k < n; k++) {
+            unsigned int id = events[k].data.u32;
+            if (id == EVENT_WAKE) {
+                // worker 交回來的連線：回覆沒寫完、還有排隊的 request 或要關閉
+                char drain[256];
+                while (read(wake_fds[0], drain, sizeof(drain)) > 0) {
+                }
+                int idx;
+                while ((idx = queue_try_pop(&done_queue)) >= 0) {
+                    Conn *c = &conns[idx];
+                    c->writing = 1;
+                    conn_flush(c);
+                    conn_next(c);
+                }
+            } else if (id == EVENT_LISTEN) {
+                accept_connections(lfd, &accept_paused_until);
+            } else {
+                Conn *c = &conns[id];
+                if (c->writing) {
+                    conn_flush(c);
+                } else {
+                    conn_read(c);
+                }
+                conn_next(c);
+            }
+        }
+    }
+
+    close(lfd);
+    unlink(sock_path);
+
+    pthread_mutex_lock(&stats.lock);
+    log_info("metrics",
+             "summary socket=%s codebooks=%d workers=%d requests=%llu errors=%llu "
+             "connections=%llu batches=%llu bytes_in=%llu bytes_out=%llu status=ok",
+             sock_path, num_coders, num_workers, stats.requests, stats.errors,
+             stats.connections, stats.batches, stats.bytes_in, stats.bytes_out);
+    pthread_mutex_unlock(&stats.lock);
+
+    log_info("huffd", "finish status=ok");
+    if (logf) fclose(logf);
+    return 0;
+}
@@ -0,0 +1,40 @@
+#ifndef HUFFD_H
+#define HUFFD_H
+
+/* huffd 與 client 之間的協定（本機 Unix domain socket，用主機 byte order）：
+   每個 request 是一個 HuffdRequest 加上 payload_len 個 byte，
+   server 依序回覆 HuffdResponse 加上 payload_len 個 byte。
+   同一條連線可以連續送出多個 request，server 會把已收到的 request 一批處理、一次寫回。 */
+
+#define HUFFD_MAGIC 0x44465548u            /* "HUFD" */
+#define HUFFD_MAX_PAYLOAD (64u << 20)
+
+enum {
+    HUFFD_OP_ENCODE = 1,   /* payload: 原始資料，回覆: encoded bitstream */
+    HUFFD_OP_DECODE = 2,   /* payload: encoded bitstream，回覆: 原始資料 */
+    HUFFD_OP_STATS  = 3    /* 回覆: key=value 格式的統計文字 */
+};
+
+enum {
+    HUFFD_OK              = 0,
+    HUFFD_ERR_BAD_REQUEST = 1,
+    HUFFD_ERR_NO_CODEBOOK = 2,
+    HUFFD_ERR_ENCODE      = 3,
+    HUFFD_ERR_DECODE      = 4,
+    HUFFD_ERR_TOO_LARGE   = 5
+};
+
+typedef struct {
+    unsigned int magic;
+    unsigned char op;
+    unsigned char codebook;       /* 啟動 huffd 時第幾個 codebook（從 0 開始） */
+    unsigned short reserved;
+    unsigned int payload_len;
+} HuffdRequest;
+
+typedef struct {
+    unsigned int status;
+    unsigned int payload_len;
+} HuffdResponse;
+
+#endif /* HUFFD_H */
@@ -2,6 +2,7 @@
 
 #include <stdarg.h>
 #include <time.h>
+#include <sys/resource.h>
 
 static log_level_t current_level   = LOG_LEVEL_INFO;
 static FILE *log_fp_info           = NULL;  /* 若為 NULL 則使用 stdout */
@@ -107,4 +108,10 @@ void log_error(const char *component, const char *fmt, ...) {
     va_start(args, fmt);
     log_vwrite(LOG_LEVEL_ERROR, component, fmt, args);
     va_end(args);
-}
\ No newline at end of file
+}
+
+long peak_rss_kb(void) {
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) return -1;
+    return ru.ru_maxrss;
+}
@@ -39,4 +39,7 @@ void log_warn(const char *component, const char *fmt, ...);
 /* 寫一行 ERROR log */
 void log_error(const char *component, const char *fmt, ...);
 
+/* 目前為止的最大 RSS（KB），metrics 用；取不到時回傳 -1 */
+long peak_rss_kb(void);
+
 #endif /* LOGGER_H */
\ No newline at end of file
@@ -0,0 +1,315 @@
+#include "tokenizer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* 候選 token 的 hash table 上限，避免超大輸入把記憶體吃光 */
+#define MAX_CANDIDATE_SLOTS (1u << 18)
+
+static void *xmalloc(size_t size) {
+    void *p = malloc(size);
+    if (!p) {
+        fprintf(stderr, "malloc failed\n");
+        exit(1);
+    }
+    return p;
+}
+
+static int is_word_byte(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+/* FNV-1a */
+static unsigned int hash_bytes(const unsigned char *s, int len) {
+    unsigned int h = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        h ^= s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* ----------------- token 字典 ----------------- */
+
+void vocab_init(TokenVocab *v, int max_tokens) {
+    if (max_tokens < 0) max_tokens = 0;
+    if (max_tokens > MAX_TOKENS) max_tokens = MAX_TOKENS;
+
+    unsigned int cap = 16;
+    while (cap < (unsigned int)max_tokens * 2) cap <<= 1;
+
+    v->tokens = (Token *)xmalloc(sizeof(Token) * (max_tokens > 0 ? max_tokens : 1));
+    v->num_tokens = 0;
+    v->max_tokens = max_tokens;
+    v->slots = (int *)xmalloc(sizeof(int) * cap);
+    for (unsigned int i = 0; i < cap; i++) v->slots[i] = -1;
+    v->mask = cap - 1;
+}
+
+void vocab_free(TokenVocab *v) {
+    free(v->tokens);
+    free(v->slots);
+    v->tokens = NULL;
+    v->slots = NULL;
+    v->num_tokens = 0;
+}
+
+/* 回傳 bytes 所在或應該放入的 slot */
+static unsigned int vocab_slot(const TokenVocab *v, const unsigned char *bytes, int len) {
+    unsigned int i = hash_bytes(bytes, len) & v->mask;
+    while (v->slots[i] != -1) {
+        const Token *t = &v->tokens[v->slots[i]];
+        if (t->len == len && memcmp(t->bytes, bytes, (size_t)len) == 0) break;
+        i = (i + 1) & v->mask;
+    }
+    return i;
+}
+
+int vocab_lookup(const TokenVocab *v, const unsigned char *bytes, int len) {
+    if (!v || v->num_tokens == 0 || len < 2 || len > MAX_TOKEN_LEN) return -1;
+    int idx = v->slots[vocab_slot(v, bytes, len)];
+    return (idx == -1) ? -1 : FIRST_TOKEN_SYMBOL + idx;
+}
+
+int vocab_add(TokenVocab *v, const unsigned char *bytes, int len) {
+    if (len < 2 || len > MAX_TOKEN_LEN) return -1;
+
+    unsigned int s = vocab_slot(v, bytes, len);
+    if (v->slots[s] != -1) return FIRST_TOKEN_SYMBOL + v->slots[s];
+    if (v->num_tokens >= v->max_tokens) return -1;
+
+    Token *t = &v->tokens[v->num_tokens];
+    memcpy(t->bytes, bytes, (size_t)len);
+    t->len = len;
+    v->slots[s] = v->num_tokens;
+    return FIRST_TOKEN_SYMBOL + v->num_tokens++;
+}
+
+/* ----------------- piece 切割 ----------------- */
+
+int next_piece(const unsigned char *buf, size_t avail, int at_eof) {
+    if (avail == 0) return 0;
+    // 最多往前看 MAX_TOKEN_LEN + 1 個 byte，資料不夠時等下一次補滿，
+    // 這樣不論 buffer 怎麼切，結果都一樣
+    if (!at_eof && avail <= MAX_TOKEN_LEN) return 0;
+
+    size_t limit = (avail < MAX_TOKEN_LEN) ? avail : MAX_TOKEN_LEN;
+    size_t i = 0;
+
+    if (buf[0] == ' ') {
+        while (i < limit && buf[i] == ' ') i++;
+        if (i < avail && is_word_byte(buf[i])) {
+            if (i > 1) return (int)(i - 1);  // 最後一個空白留給後面的單字
+            while (i < limit && is_word_byte(buf[i])) i++;
+        }
+        return (int)i;
+    }
+
+    if (is_word_byte(buf[0])) {
+        while (i < limit && is_word_byte(buf[i])) i++;
+        return (int)i;
+    }
+
+    return 1;
+}
+
+void piece_reader_init(PieceReader *r, FILE *f) {
+    r->f = f;
+    r->pos = 0;
+    r->len = 0;
+    r->eof = 0;
+}
+
+int piece_reader_next(PieceReader *r, const unsigned char **piece) {
+    while (!r->eof && r->len - r->pos <= MAX_TOKEN_LEN) {
+        memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+        r->len -= r->pos;
+        r->pos = 0;
+
+        size_t n = fread(r->buf + r->len, 1, sizeof(r->buf) - r->len, r->f);
+        r->len += n;
+        if (n == 0) r->eof = 1;
+    }
+
+    int n = next_piece(r->buf + r->pos, r->len - r->pos, r->eof);
+    *piece = r->buf + r->pos;
+    r->pos += (size_t)n;
+    return n;
+}
+
+/* ----------------- 訓練 ----------------- */
+
+typedef struct {
+    unsigned char bytes[MAX_TOKEN_LEN];
+    int len;
+    unsigned long long count;   /* 0 表示空 slot */
+} Candidate;
+
+typedef struct {
+    Candidate *slots;
+    unsigned int mask;
+    unsigned int used;
+} CandidateTable;
+
+static void cand_init(CandidateTable *ct, unsigned int cap) {
+    ct->slots = (Candidate *)calloc(cap, sizeof(Candidate));
+    if (!ct->slots) {
+        fprintf(stderr, "malloc failed\n");
+        exit(1);
+    }
+    ct->mask = cap - 1;
+    ct->used = 0;
+}
+
+static Candidate *cand_slot(CandidateTable *ct, const unsigned char *bytes, int len) {
+    unsigned int i = hash_bytes(bytes, len) & ct->mask;
+    while (ct->slots[i].count != 0) {
+        Candidate *c = &ct->slots[i];
+        if (c->len == len && memcmp(c->bytes, bytes, (size_t)len) == 0) break;
+        i = (i + 1) & ct->mask;
+    }
+    return &ct->slots[i];
+}
+
+static void cand_grow(CandidateTable *ct) {
+    CandidateTable bigger;
+    cand_init(&bigger, (ct->mask + 1) * 2);
+    for (unsigned int i = 0; i <= ct->mask; i++) {
+        Candidate *c = &ct->slots[i];
+        if (c->count == 0) continue;
+        *cand_slot(&bigger, c->bytes, c->len) = *c;
+        bigger.used++;
+    }
+    free(ct->slots);
+    *ct = bigger;
+}
+
+static void cand_add(CandidateTable *ct, const unsigned char *bytes, int len) {
+    Candidate *c = cand_slot(ct, bytes, len);
+    if (c->count != 0) {
+        c->count++;
+        return;
+    }
+
+    if (ct->used * 2 >= ct->mask + 1) {
+        if (ct->mask + 1 >= MAX_CANDIDATE_SLOTS) {
+            // 表已滿：只累計已經出現過的候選
+            if (ct->used * 4 >= (ct->mask + 1) * 3) return;
+        } else {
+            cand_grow(ct);
+            c = cand_slot(ct, bytes, len);
+        }
+    }
+
+    memcpy(c->bytes, bytes, (size_t)len);
+    c->len = len;
+    c->count = 1;
+    ct->used++;
+}
+
+/* 省下的 symbol 數：每次出現可以把 len 個 byte 換成 1 個 token */
+static unsigned long long cand_score(const Candidate *c) {
+    return c->count * (unsigned long long)(c->len - 1);
+}
+
+static int cmp_candidate(const void *a, const void *b) {
+    const Candidate *x = (const Candidate *)a;
+    const Candidate *y = (const Candidate *)b;
+    unsigned long long sx = cand_score(x), sy = cand_score(y);
+    if (sx != sy) return (sx > sy) ? -1 : 1;
+    if (x->len != y->len) return x->len - y->len;
+    return memcmp(x->bytes, y->bytes, (size_t)x->len);
+}
+
+int vocab_train(TokenVocab *v, FILE *f, int max_tokens, unsigned long long sample_bytes) {
+    CandidateTable ct;
+    cand_init(&ct, 4096);
+
+    PieceReader *r = (PieceReader *)xmalloc(sizeof(PieceReader));
+    piece_reader_init(r, f);
+
+    const unsigned char *p;
+    int n;
+    int prev = -1;   /* 上一個單一 byte piece，用來數 byte pair */
+    unsigned long long seen = 0;
+
+    while ((n = piece_reader_next(r, &p)) > 0) {
+        if (sample_bytes > 0 && seen >= sample_bytes) break;
+        seen += (unsigned long long)n;
+        if (n >= 2) {
+            cand_add(&ct, p, n);
+            prev = -1;
+        } else {
+            if (prev >= 0) {
+                unsigned char pair[2] = { (unsigned char)prev, p[0] };
+                cand_add(&ct, pair, 2);
+            }
+            prev = p[0];
+        }
+    }
+    free(r);
+
+    /* 只留出現兩次以上的候選，依省下的 symbol 數排序 */
+    unsigned int m = 0;
+    for (unsigned int i = 0; i <= ct.mask; i++) {
+        if (ct.slots[i].count >= 2) ct.slots[m++] = ct.slots[i];
+    }
+    qsort(ct.slots, m, sizeof(Candidate), cmp_candidate);
+
+    int added = 0;
+    for (unsigned int i = 0; i < m && added < max_tokens; i++) {
+        if (vocab_add(v, ct.slots[i].bytes, ct.slots[i].len) < 0) break;
+        added++;
+    }
+
+    free(ct.slots);
+    return added;
+}
+
+/* ----------------- piece -> symbol ----------------- */
+
+void token_encoder_init(TokenEncoder *te, const TokenVocab *vocab, symbol_fn emit, void *ctx) {
+    te->vocab = vocab;
+    te->emit = emit;
+    te->ctx = ctx;
+    te->pending = -1;
+}
+
+static void token_encoder_byte(TokenEncoder *te, unsigned char b) {
+    if (te->pending < 0) {
+        te->pending = b;
+        return;
+    }
+
+    unsigned char pair[2] = { (unsigned char)te->pending, b };
+    int sym = vocab_lookup(te->vocab, pair, 2);
+    if (sym >= 0) {
+        te->emit(sym, te->ctx);
+        te->pending = -1;
+    } else {
+        te->emit(te->pending, te->ctx);
+        te->pending = b;
+    }
+}
+
+void token_encoder_flush(TokenEncoder *te) {
+    if (te->pending >= 0) {
+        te->emit(te->pending, te->ctx);
+        te->pending = -1;
+    }
+}
+
+void token_encoder_piece(TokenEncoder *te, const unsigned char *piece, int len) {
+    if (len >= 2) {
+        int sym = vocab_lookup(te->vocab, piece, len);
+        if (sym >= 0) {
+            token_encoder_flush(te);
+            te->emit(sym, te->ctx);
+            return;
+        }
+    }
+
+    for (int i = 0; i < len; i++) {
+        token_encoder_byte(te, piece[i]);
+    }
+}
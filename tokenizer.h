@@ -0,0 +1,89 @@
+#ifndef TOKENIZER_H
+#define TOKENIZER_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/* symbol 編號：
+   - 0 ~ 255                : 單一 byte（byte fallback）
+   - EOF_SYMBOL             : 結束符號
+   - FIRST_TOKEN_SYMBOL 以後 : 訓練出來的 token（常見單字、空白串、byte pair） */
+#define NUM_BYTE_SYMBOLS   256
+#define EOF_SYMBOL         256
+#define FIRST_TOKEN_SYMBOL 257
+#define MAX_TOKENS         8192
+#define MAX_ALPHABET       (FIRST_TOKEN_SYMBOL + MAX_TOKENS)
+
+/* 單一 token 最長的 byte 數，也是切 piece 時最多往前看的距離 */
+#define MAX_TOKEN_LEN 32
+
+typedef struct {
+    unsigned char bytes[MAX_TOKEN_LEN];
+    int len;
+} Token;
+
+/* token 字典：tokens[i] 對應 symbol FIRST_TOKEN_SYMBOL + i，
+   用 open addressing hash 由 bytes 查 symbol */
+typedef struct {
+    Token *tokens;
+    int num_tokens;
+    int max_tokens;
+    int *slots;            /* 存 tokens 的 index，-1 表示空 */
+    unsigned int mask;
+} TokenVocab;
+
+void vocab_init(TokenVocab *v, int max_tokens);
+void vocab_free(TokenVocab *v);
+
+/* 加入 token，回傳 symbol 編號；字典已滿回傳 -1 */
+int vocab_add(TokenVocab *v, const unsigned char *bytes, int len);
+
+/* 查 token，回傳 symbol 編號；找不到回傳 -1 */
+int vocab_lookup(const TokenVocab *v, const unsigned char *bytes, int len);
+
+/* 掃過 f（從目前位置起最多 sample_bytes 個 byte，0 表示到結尾），
+   挑出最多 max_tokens 個最划算的 token 加進字典，回傳實際加入的數量 */
+int vocab_train(TokenVocab *v, FILE *f, int max_tokens, unsigned long long sample_bytes);
+
+/* ----------------- piece 切割 -----------------
+   piece 是 token 的候選單位：
+   - 可帶一個前導空白的英文單字，例如 " Holmes"
+   - 連續空白
+   - 其他單一 byte
+   回傳 buf 開頭那個 piece 的長度；若 at_eof 為 0 且資料可能不完整則回傳 0 */
+int next_piece(const unsigned char *buf, size_t avail, int at_eof);
+
+#define PIECE_READER_BUF 65536
+
+/* 從 FILE 串流讀 piece，記憶體用量固定 */
+typedef struct {
+    FILE *f;
+    unsigned char buf[PIECE_READER_BUF];
+    size_t pos;
+    size_t len;
+    int eof;
+} PieceReader;
+
+void piece_reader_init(PieceReader *r, FILE *f);
+
+/* 讀下一個 piece，*piece 指向內部 buffer；回傳長度，讀完回傳 0 */
+int piece_reader_next(PieceReader *r, const unsigned char **piece);
+
+/* ----------------- piece -> symbol ----------------- */
+
+typedef void (*symbol_fn)(int sym, void *ctx);
+
+/* 把 piece 轉成 symbol 序列：字典裡有的 piece 直接輸出 token，
+   否則拆成 byte，相鄰 byte 若剛好是字典裡的 byte pair 就合併 */
+typedef struct {
+    const TokenVocab *vocab;
+    symbol_fn emit;
+    void *ctx;
+    int pending;           /* 還沒輸出的 byte，-1 表示沒有 */
+} TokenEncoder;
+
+void token_encoder_init(TokenEncoder *te, const TokenVocab *vocab, symbol_fn emit, void *ctx);
+void token_encoder_piece(TokenEncoder *te, const unsigned char *piece, int len);
+void token_encoder_flush(TokenEncoder *te);
+
+#endif /* TOKENIZER_H */